@@ -34,28 +34,32 @@
 #include <errno.h>
 #include <stdarg.h>
 
-#define err(exitcode, format, args...) \
-	errx(exitcode, format ": %s", ## args, strerror(errno))
-#define errx(exitcode, format, args...) \
-	{ warnx(format, ## args); exit(exitcode); }
-#define warn(format, args...) \
-	warnx(format ": %s", ## args, strerror(errno))
-#define warnx(format, args...) \
-	fprintf(stderr, format "\n", ## args)
-
 __BEGIN_DECLS
+void warn(const char *format, ...)
+	__printflike(1, 2);
+void warnx(const char *format, ...)
+	__printflike(1, 2);
 void warnc(int code, const char *format, ...)
 	__printflike(2, 3);
 void vwarn(const char *format, va_list ap)
 	__printflike(1, 0);
+void vwarnx(const char *format, va_list ap)
+	__printflike(1, 0);
 void vwarnc(int code, const char *format, va_list ap)
 	__printflike(2, 0);
+void err(int status, const char *format, ...)
+	__printflike(2, 3) __dead2;
+void errx(int status, const char *format, ...)
+	__printflike(2, 3) __dead2;
 void errc(int status, int code, const char *format, ...)
-	__printflike(3, 4);
+	__printflike(3, 4) __dead2;
 void verr(int status, const char *format, va_list ap)
-	__printflike(2, 0);
+	__printflike(2, 0) __dead2;
+void verrx(int status, const char *format, va_list ap)
+	__printflike(2, 0) __dead2;
 void verrc(int status, int code, const char *format, va_list ap)
-	__printflike(3, 0);
+	__printflike(3, 0) __dead2;
+void warn_ratelimit(unsigned int burst);
 __END_DECLS
 
 #endif
@@ -57,7 +57,10 @@
 #ifdef __sun__
 #define off_t	off64_t
 #endif
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #define ES__RESTRICT __restrict__
 #define _ESTREAM_GCC_A_PRINTF( f, a )  __attribute__ ((format (printf,f,a)))
@@ -120,6 +123,30 @@ typedef struct es_cookie_io_functions_t
 /* The opaque type for an estream.  */
 typedef struct es__stream *estream_t;
 
+/* The opaque type for a sparse line index of a stream.  */
+typedef struct es_lineidx_s *es_lineidx_t;
+
+/* A format string parsed in advance by es_format_compile.  */
+typedef struct estream_format_s *es_format_t;
+
+/* I/O statistics of a stream as returned by es_stats.  Setting the
+   environment variable ESTREAM_STATS prints them for all open streams
+   at exit.  */
+struct es_stats_s
+{
+  unsigned long long bytes_in;    /* Bytes read from the backend.  */
+  unsigned long long bytes_out;   /* Bytes written to the backend.  */
+  unsigned long long syscalls;    /* Calls of the backend I/O functions.  */
+  unsigned long long fills;       /* Read buffer refills.  */
+  unsigned long long flushes;     /* Write buffer flushes.  */
+  unsigned long long seeks;       /* Seek requests.  */
+  unsigned long long seeks_buffered; /* Seeks done within the buffer.  */
+  unsigned long long unbuffered;  /* Transfers bypassing the buffer.  */
+  unsigned long long io_nsec;     /* Time spent in backend I/O, only
+                                     measured after es_stats_timing or
+                                     with ESTREAM_STATS set.  */
+};
+
 int es_init (void);
 
 estream_t es_fopencookie (void *ES__RESTRICT cookie,
@@ -133,11 +160,21 @@ estream_t _es_get_std_stream (int fd);
 #define es_stdout _es_get_std_stream (1)
 #define es_stderr _es_get_std_stream (2)
 
+/* Compression methods for es_fopencompress.  */
+#define ES_COMPRESS_GZIP  1
+#define ES_COMPRESS_ZSTD  2
+
+estream_t es_fopencompress (estream_t ES__RESTRICT stream,
+			    const char *ES__RESTRICT mode,
+			    int method, int level);
+
 int es_fclose (estream_t stream);
 int es_fseek  (estream_t stream, long int offset, int whence);
 int es_fseeko (estream_t stream, off_t offset, int whence);
 int es_fileno (estream_t stream);
 int es_ferror (estream_t stream);
+int es_stats  (estream_t stream, struct es_stats_s *r_stats);
+int es_stats_timing (estream_t stream, int on);
 int es_fflush (estream_t stream);
 void es_clearerr (estream_t stream);
 void es_clearerr_unlocked (estream_t stream);
@@ -152,12 +189,25 @@ int es_read      (estream_t ES__RESTRICT stream,
 int es_write     (estream_t ES__RESTRICT stream,
 	          const void *ES__RESTRICT buffer, size_t bytes_to_write,
 	          size_t *ES__RESTRICT bytes_written);
+int es_writev    (estream_t ES__RESTRICT stream,
+	          const struct iovec *iov, int iovcnt,
+	          size_t *ES__RESTRICT bytes_written);
 size_t es_fread  (void *ES__RESTRICT ptr, size_t size, size_t nitems,
 		  estream_t ES__RESTRICT stream);
 size_t es_fwrite (const void *ES__RESTRICT ptr, size_t size, size_t memb,
 		  estream_t ES__RESTRICT stream);
 void es_free (void *a);
 
+es_lineidx_t es_lineidx_build (estream_t stream, unsigned int every);
+es_lineidx_t es_lineidx_open (estream_t ES__RESTRICT stream,
+			      const char *ES__RESTRICT fname,
+			      unsigned int every);
+int es_lineidx_save (es_lineidx_t idx, const char *fname);
+int es_lineidx_seek (estream_t stream, es_lineidx_t idx,
+		     unsigned long long lineno);
+unsigned long long es_lineidx_lines (es_lineidx_t idx);
+void es_lineidx_free (es_lineidx_t idx);
+
 int es_fprintf (estream_t ES__RESTRICT stream,
 		const char *ES__RESTRICT format, ...)
      _ESTREAM_GCC_A_PRINTF(2,3);
@@ -171,4 +221,208 @@ int es_vfprintf (estream_t ES__RESTRICT stream,
 int es_vfprintf_unlocked (estream_t ES__RESTRICT stream,
                           const char *ES__RESTRICT format, va_list ap)
      _ESTREAM_GCC_A_PRINTF(2,0);
+
+int _es_print_signed (estream_t stream, long long value, int newline);
+int _es_print_unsigned (estream_t stream, unsigned long long value,
+			int newline);
+int _es_print_string (estream_t stream, const char *string, int newline);
+
+/* With GCC and C11, es_fprintf calls whose format is a literal
+   without any conversion, or with exactly one of "%s", "%d", "%ld",
+   "%lld", "%u", "%lu", "%llu" or "%zu" optionally followed by a
+   newline, are dispatched at compile time to the writers above.
+   Nothing is parsed at run time for them.  The argument type must
+   match the conversion exactly; all other calls, including those
+   with more than one argument, use the real es_fprintf.  Its format
+   attribute keeps checking the arguments in every case, unless this
+   file is included from a system directory: GCC does not warn inside
+   macros from system headers.  Define ES__NO_PRINTF_SPECIALIZATION
+   before including this file to get the plain function, or write
+   (es_fprintf) to bypass the macro for a single call.  The dispatch
+   needs __VA_OPT__ (GCC 8, Clang 12), which places no limit on the
+   number of arguments; without it the plain function is used.  */
+#define ES__VA_OPT_THIRD(a,b,c,...) c
+#define ES__VA_OPT_TEST(...) ES__VA_OPT_THIRD (__VA_OPT__ (,), 1, 0, )
+#if defined(__GNUC__) && defined(__STDC_VERSION__) \
+    && __STDC_VERSION__ >= 201112L && !defined(ES__NO_PRINTF_SPECIALIZATION) \
+    && ES__VA_OPT_TEST (x)
+
+#define ES__INTKIND(a)							\
+  _Generic ((a), signed char: 1, short: 1, int: 1, long: 2, long long: 3, \
+	    unsigned char: 4, unsigned short: 4, unsigned int: 4,	\
+	    unsigned long: 5, unsigned long long: 6, default: 0)
+#define ES__AS_SIGNED(a)						\
+  _Generic ((a), signed char: (a), short: (a), int: (a), long: (a),	\
+	    long long: (a), default: 0)
+#define ES__AS_UNSIGNED(a)						\
+  _Generic ((a), unsigned char: (a), unsigned short: (a),		\
+	    unsigned int: (a), unsigned long: (a),			\
+	    unsigned long long: (a), default: 0U)
+#define ES__AS_STRING(a)						\
+  _Generic ((a), char *: (a), const char *: (a), default: (const char *)0)
+#define ES__IS_STRING(a)						\
+  _Generic ((a), char *: 1, const char *: 1, default: 0)
+
+#define ES__FMT_IS(f,lit)  (!__builtin_strcmp ((f), lit))
+
+/* Evaluates to a "COND ? CALL :" fragment for the formats LIT and
+   LIT followed by a newline.  */
+#define ES__PRINTF_CASE(stream,f,lit,cond,fnc,val)			\
+  (cond) && ES__FMT_IS (f, lit) ? fnc ((stream), (val), 0)		\
+  : (cond) && ES__FMT_IS (f, lit "\n") ? fnc ((stream), (val), 1)
+
+#define ES__PRINTF_0(stream,f)						\
+  (__builtin_constant_p (f) && !__builtin_strchr ((f), '%')		\
+   ? _es_print_string ((stream), (f), 0)				\
+   : (es_fprintf) ((stream), (f)))
+
+#define ES__PRINTF_1(stream,f,a)					\
+  (!__builtin_constant_p (f) ? (es_fprintf) ((stream), (f), (a))	\
+   : ES__PRINTF_CASE (stream, f, "%s", ES__IS_STRING (a),		\
+		      _es_print_string, ES__AS_STRING (a))		\
+   : ES__PRINTF_CASE (stream, f, "%d", ES__INTKIND (a) == 1,		\
+		      _es_print_signed, ES__AS_SIGNED (a))		\
+   : ES__PRINTF_CASE (stream, f, "%ld", ES__INTKIND (a) == 2,		\
+		      _es_print_signed, ES__AS_SIGNED (a))		\
+   : ES__PRINTF_CASE (stream, f, "%lld", ES__INTKIND (a) == 3,		\
+		      _es_print_signed, ES__AS_SIGNED (a))		\
+   : ES__PRINTF_CASE (stream, f, "%u", ES__INTKIND (a) == 4,		\
+		      _es_print_unsigned, ES__AS_UNSIGNED (a))		\
+   : ES__PRINTF_CASE (stream, f, "%lu", ES__INTKIND (a) == 5,		\
+		      _es_print_unsigned, ES__AS_UNSIGNED (a))		\
+   : ES__PRINTF_CASE (stream, f, "%llu", ES__INTKIND (a) == 6,		\
+		      _es_print_unsigned, ES__AS_UNSIGNED (a))		\
+   : ES__PRINTF_CASE (stream, f, "%zu",					\
+		      ES__INTKIND (a) >= 4 && sizeof (a) == sizeof (size_t), \
+		      _es_print_unsigned, ES__AS_UNSIGNED (a))		\
+   : (es_fprintf) ((stream), (f), (a)))
+
+#define ES__PRINTF_N(stream,...) (es_fprintf) ((stream), __VA_ARGS__)
+
+/* Selects ES__PRINTF_0, ES__PRINTF_1 or ES__PRINTF_N by whether
+   anything follows the format and its first argument.  __VA_OPT__
+   does not count, so any number of arguments is accepted.  */
+#define ES__PRINTF_SEL(f,...)						\
+  ES__PRINTF_FIRST (__VA_OPT__ (ES__PRINTF_SEL1 (__VA_ARGS__),) ES__PRINTF_0, )
+#define ES__PRINTF_SEL1(a,...)						\
+  ES__PRINTF_FIRST1 (__VA_OPT__ (ES__PRINTF_N,) ES__PRINTF_1, )
+#define ES__PRINTF_FIRST(x,...) x
+#define ES__PRINTF_FIRST1(x,...) x
+#define es_fprintf(stream,...)						\
+  ES__PRINTF_SEL (__VA_ARGS__) (stream, __VA_ARGS__)
+
+#endif /*__GNUC__ && C11*/
+
+es_format_t es_format_compile (const char *format);
+void es_format_release (es_format_t fmt);
+int es_fprintf_compiled (estream_t ES__RESTRICT stream,
+			 es_format_t fmt, ...);
+int es_vfprintf_compiled (estream_t ES__RESTRICT stream,
+			  es_format_t fmt, va_list ap);
+
+/* Print VALUE to BUF like snprintf with the conversion CONV, one of
+   'e', 'E', 'f', 'F', 'g' or 'G', but with the shortest string of
+   digits that reads back to the same double, e.g. for serialization.
+   No flags, width or precision apply and the decimal point is always
+   a '.'.  */
+int es_fmt_double_shortest (char *buf, size_t bufsize, int conv,
+			    double value);
+
+/* The types of the values passed to es_fprintf_values.  Note that we
+   list all the types we know about even if certain types are not
+   available on this system. */
+typedef enum
+  {
+    ES_VALTYPE_UNSUPPORTED = 0,  /* Artificial type for error detection.  */
+    ES_VALTYPE_CHAR,
+    ES_VALTYPE_SCHAR,
+    ES_VALTYPE_UCHAR,
+    ES_VALTYPE_SHORT,
+    ES_VALTYPE_USHORT,
+    ES_VALTYPE_INT,
+    ES_VALTYPE_UINT,
+    ES_VALTYPE_LONG,
+    ES_VALTYPE_ULONG,
+    ES_VALTYPE_LONGLONG,
+    ES_VALTYPE_ULONGLONG,
+    ES_VALTYPE_DOUBLE,
+    ES_VALTYPE_LONGDOUBLE,
+    ES_VALTYPE_STRING,
+    ES_VALTYPE_INTMAX,
+    ES_VALTYPE_UINTMAX,
+    ES_VALTYPE_SIZE,
+    ES_VALTYPE_PTRDIFF,
+    ES_VALTYPE_POINTER,
+    ES_VALTYPE_CHAR_PTR,
+    ES_VALTYPE_SCHAR_PTR,
+    ES_VALTYPE_SHORT_PTR,
+    ES_VALTYPE_INT_PTR,
+    ES_VALTYPE_LONG_PTR,
+    ES_VALTYPE_LONGLONG_PTR,
+    ES_VALTYPE_INTMAX_PTR,
+    ES_VALTYPE_SIZE_PTR,
+    ES_VALTYPE_PTRDIFF_PTR
+  } es_valtype_t;
+
+
+/* A union used to store the actual values. */
+typedef union 
+{
+  char a_char;
+  signed char a_schar;
+  unsigned char a_uchar;
+  short a_short;
+  unsigned short a_ushort;
+  int a_int;
+  unsigned int a_uint;
+  long int a_long;
+  unsigned long int a_ulong;
+  long long int a_longlong;
+  unsigned long long int a_ulonglong;
+  double a_double;
+  long double a_longdouble;
+  const char *a_string;
+  intmax_t a_intmax;
+  intmax_t a_uintmax;
+  size_t a_size;
+  ptrdiff_t a_ptrdiff;
+  void *a_void_ptr;
+  char *a_char_ptr;
+  signed char *a_schar_ptr;
+  short *a_short_ptr;
+  int  *a_int_ptr;
+  long *a_long_ptr;
+  long long int *a_longlong_ptr;
+  intmax_t *a_intmax_ptr;
+  size_t *a_size_ptr;
+  ptrdiff_t *a_ptrdiff_ptr;
+} es_value_t;
+
+/* An object to build up a table of values and their types.  */
+struct es_valueitem_s
+{
+  es_valtype_t vt;  /* The type of the value.  */
+  es_value_t value;  /* The value.  */
+};
+typedef struct es_valueitem_s *es_valueitem_t;
+
+int es_fprintf_values (estream_t ES__RESTRICT stream, es_format_t fmt,
+		       const struct es_valueitem_s *values, size_t nvalues);
+
+/* An async-signal-safe subset of the formatting for signal handlers
+   and children after fork: no memory is allocated and neither locks
+   nor stdio are used.  Only the flags "-0+ #", field width and
+   precision (also as '*'), the length modifiers "hh,h,l,ll,z,j,t" and
+   the conversions "d,i,u,o,x,X,c,s,p,m,%" are supported; positional
+   arguments are not, and "%m" prints the error number.  Unsupported
+   conversions fail with EINVAL.  */
+int estream_safe_snprintf (char *buf, size_t bufsize, const char *format, ...)
+     _ESTREAM_GCC_A_PRINTF(3,4);
+int estream_safe_vsnprintf (char *buf, size_t bufsize,
+                            const char *format, va_list arg_ptr)
+     _ESTREAM_GCC_A_PRINTF(3,0);
+int estream_safe_dprintf (int fd, const char *format, ...)
+     _ESTREAM_GCC_A_PRINTF(2,3);
+int estream_safe_vdprintf (int fd, const char *format, va_list arg_ptr)
+     _ESTREAM_GCC_A_PRINTF(2,0);
 #endif /*ESTREAM_H*/
@@ -0,0 +1,24 @@
+#ifndef LIBBSD_MAPLINE_H
+#define LIBBSD_MAPLINE_H
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*
+ * Line iterator over a memory mapped file.  Lines are returned as
+ * pointers into the mapping, including the trailing newline (like
+ * fgetln), and stay valid until ml_close().
+ */
+typedef struct _maplines MapLines;
+
+typedef int (*ml_func_t)(const char *, size_t, unsigned int, void *);
+
+__BEGIN_DECLS
+MapLines	*ml_open(const char *);
+MapLines	*ml_fdopen(int);
+const char	*ml_next(MapLines *, size_t *);
+void		 ml_rewind(MapLines *);
+int		 ml_foreach(MapLines *, unsigned int, ml_func_t, void *);
+int		 ml_close(MapLines *);
+__END_DECLS
+
+#endif /* LIBBSD_MAPLINE_H */
@@ -5,7 +5,14 @@
 
 #include <sys/types.h>
 
+struct strspan {
+	const char	*ss_str;
+	size_t		 ss_len;
+};
+
 char	*strsep(char **, const char *);
+size_t	strspans(const char *, size_t, const char *, struct strspan *,
+	    size_t);
 char	*strndup(const char *str, size_t n);
 char	*strcasestr(const char *, const char *);
 char	*strnstr(const char *, const char *, size_t);
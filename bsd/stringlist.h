@@ -10,14 +10,32 @@ typedef struct _stringlist {
 	char	**sl_str;
 	size_t	  sl_max;
 	size_t	  sl_cur;
+	struct _sl_index *sl_index;	/* see sl_init_hashed() */
+	struct _sl_arena *sl_arena;	/* see sl_add_copy() */
 } StringList;
 
+/*
+ * Multi-pattern matcher compiled from a StringList
+ */
+typedef struct _slmatcher SLMatcher;
+
+#define	SL_MATCH_EXACT	0x01	/* the whole string equals a pattern */
+#define	SL_MATCH_SUBSTR	0x02	/* a pattern occurs in the string */
+#define	SL_MATCH_ICASE	0x04	/* ignore case */
+
 __BEGIN_DECLS
 StringList	*sl_init(void);
+StringList	*sl_init_hashed(void);
 int		 sl_add(StringList *, char *);
+int		 sl_add_copy(StringList *, const char *);
 void		 sl_free(StringList *, int);
 char		*sl_find(StringList *, const char *);
 int		 sl_delete(StringList *, const char *, int);
+
+SLMatcher	*sl_match_init(StringList *, int);
+char		*sl_match(SLMatcher *, const char *, size_t *);
+char		*sl_matchn(SLMatcher *, const char *, size_t, size_t *);
+void		 sl_match_free(SLMatcher *);
 __END_DECLS
 
 #endif /* LIBBSD_STRINGLIST_H */
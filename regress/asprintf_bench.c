@@ -0,0 +1,130 @@
+/*
+ * Cost of asprintf() against the two-pass vsnprintf() version it
+ * replaced, for short and long output.
+ *
+ * usage: asprintf_bench [count]
+ *
+ * count is the number of calls for the short string; the longer ones
+ * use fewer calls so that each size moves a similar amount of data.
+ * Both implementations must produce the same strings.
+ */
+
+#include <err.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the previous implementation, measuring first and then formatting */
+static int
+old_vasprintf(char **strp, const char *fmt, va_list args)
+{
+	va_list args_copy;
+	int status, needed;
+
+	va_copy(args_copy, args);
+	needed = vsnprintf(NULL, 0, fmt, args_copy);
+	va_end(args_copy);
+	if (needed < 0) {
+		*strp = NULL;
+		return needed;
+	}
+	*strp = malloc(needed + 1);
+	if (*strp == NULL)
+		return -1;
+	status = vsnprintf(*strp, needed + 1, fmt, args);
+	if (status >= 0)
+		return status;
+	free(*strp);
+	*strp = NULL;
+	return status;
+}
+
+static int
+old_asprintf(char **strp, const char *fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	va_start(ap, fmt);
+	r = old_vasprintf(strp, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+pass(const char *name, const char *arg, unsigned long n,
+    int (*fn)(char **, const char *, ...))
+{
+	char *s;
+	size_t total = 0;
+	unsigned long i;
+	double t;
+	int r;
+
+	t = now();
+	for (i = 0; i < n; i++) {
+		if ((r = fn(&s, "%lu: %s (%d)\n", i, arg, (int)(i % 1000)))
+		    == -1)
+			err(1, "%s", name);
+		total += r;
+		free(s);
+	}
+	t = now() - t;
+	printf("  %-9s %8.1f ns/call, %zu bytes\n", name, t * 1e9 / n,
+	    total);
+	return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const size_t sizes[] = { 8, 200, 20000 };
+	unsigned long n = 1000000, calls;
+	char *arg, *a, *b;
+	size_t i;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: asprintf_bench [count]\n");
+		return 2;
+	}
+	if (argc == 2)
+		n = strtoul(argv[1], NULL, 10);
+	if (n == 0)
+		errx(1, "count must be positive");
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if ((arg = malloc(sizes[i] + 1)) == NULL)
+			err(1, NULL);
+		memset(arg, 'x', sizes[i]);
+		arg[sizes[i]] = '\0';
+
+		if (asprintf(&a, "%s %d %5.2f", arg, -7, 2.5) == -1 ||
+		    old_asprintf(&b, "%s %d %5.2f", arg, -7, 2.5) == -1)
+			err(1, "asprintf");
+		if (strcmp(a, b) != 0)
+			errx(1, "output differs for %zu bytes", sizes[i]);
+		free(a);
+		free(b);
+
+		calls = sizes[i] > 200 ? n / 20 : n;
+		if (calls == 0)
+			calls = 1;
+		printf("%zu byte argument, %lu calls:\n", sizes[i], calls);
+		if (pass("two-pass", arg, calls, old_asprintf) !=
+		    pass("asprintf", arg, calls, asprintf))
+			errx(1, "byte counts differ");
+		free(arg);
+	}
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Throughput of bzero() against the word loop it used before the SSE2
+ * version, and against the memset() of the C library, across sizes.
+ *
+ * usage: bzero_bench [megabytes]
+ *
+ * Each size is cleared repeatedly until the given amount (1024 MB by
+ * default) has been written.  From BZERO_NT_THRESHOLD (4 MB) on,
+ * bzero() uses non-temporal stores, so the largest sizes also show
+ * the cost of going around the caches.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define	wsize	sizeof(u_int)
+#define	wmask	(wsize - 1)
+
+/*
+ * the previous implementation; the empty asm keeps the compiler from
+ * turning the loops back into a memset() call or vectorizing them
+ */
+static void
+old_bzero(void *dst0, size_t length)
+{
+	size_t t;
+	u_char *dst;
+
+	dst = dst0;
+	if (length < 3 * wsize) {
+		while (length != 0) {
+			*dst++ = 0;
+			--length;
+			__asm__ __volatile__("" : : : "memory");
+		}
+		return;
+	}
+
+	if ((t = (long)dst & wmask) != 0) {
+		t = wsize - t;
+		length -= t;
+		do {
+			*dst++ = 0;
+			__asm__ __volatile__("" : : : "memory");
+		} while (--t != 0);
+	}
+
+	t = length / wsize;
+	do {
+		*(u_int *)dst = 0;
+		dst += wsize;
+		__asm__ __volatile__("" : : : "memory");
+	} while (--t != 0);
+
+	t = length & wmask;
+	if (t != 0)
+		do {
+			*dst++ = 0;
+			__asm__ __volatile__("" : : : "memory");
+		} while (--t != 0);
+}
+
+static void
+libc_memset(void *dst, size_t length)
+{
+	memset(dst, 0, length);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+pass(void (*fn)(void *, size_t), u_char *buf, size_t size, size_t total)
+{
+	size_t i, n;
+	double t;
+
+	n = total / size;
+	if (n == 0)
+		n = 1;
+	/* unaligned by one byte, as a caller's buffer may be */
+	t = now();
+	for (i = 0; i < n; i++)
+		fn(buf + 1, size);
+	t = now() - t;
+	if (buf[1] != 0 || buf[size] != 0)
+		errx(1, "buffer of %zu bytes not cleared", size);
+	return t > 0 ? (double)n * size / t / 1e9 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const size_t sizes[] = {
+		16, 64, 256, 4096, 65536, 1 << 20, 16 << 20, 64 << 20
+	};
+	size_t i, total = (size_t)1024 << 20;
+	u_char *buf;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: bzero_bench [megabytes]\n");
+		return 2;
+	}
+	if (argc == 2)
+		total = strtoul(argv[1], NULL, 10) << 20;
+	if (total == 0)
+		errx(1, "amount must be positive");
+	if ((buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1] + 1))
+	    == NULL)
+		err(1, NULL);
+
+	printf("%10s %12s %12s %12s\n", "size", "word loop", "bzero",
+	    "memset");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		memset(buf, 1, sizes[i] + 1);
+		printf("%10zu", sizes[i]);
+		printf(" %7.1f GB/s", pass(old_bzero, buf, sizes[i], total));
+		memset(buf, 1, sizes[i] + 1);
+		printf(" %7.1f GB/s", pass(bzero, buf, sizes[i], total));
+		memset(buf, 1, sizes[i] + 1);
+		printf(" %7.1f GB/s\n", pass(libc_memset, buf, sizes[i],
+		    total));
+	}
+	free(buf);
+	return 0;
+}
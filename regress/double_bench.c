@@ -0,0 +1,133 @@
+/*
+ * Cost of the double conversions of estream_snprintf() and
+ * estream_snprintf_shortest() against the snprintf() of the C library.
+ *
+ * usage: double_bench [count]
+ *
+ * Each value set is converted once per format.  "%.17g" is the C
+ * library's way to get a string that reads back exactly and is the
+ * baseline for the shortest conversion; every shortest string is also
+ * read back with strtod() and must give the same value.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "estream-printf.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+next(uint64_t *state)
+{
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *state;
+}
+
+static int
+libc_fmt(char *buf, size_t size, const char *fmt, double v)
+{
+	return snprintf(buf, size, fmt, v);
+}
+
+static int
+estream_fmt(char *buf, size_t size, const char *fmt, double v)
+{
+	return estream_snprintf(buf, size, fmt, v);
+}
+
+static int
+shortest_fmt(char *buf, size_t size, const char *fmt, double v)
+{
+	return estream_snprintf_shortest(buf, size, fmt[1], v);
+}
+
+static void
+pass(const char *name, const char *fmt, const double *v, size_t n,
+    int (*fn)(char *, size_t, const char *, double))
+{
+	char buf[512];
+	size_t i, total = 0;
+	double t;
+
+	t = now();
+	for (i = 0; i < n; i++)
+		total += fn(buf, sizeof(buf), fmt, v[i]);
+	t = now() - t;
+	printf("  %-9s %-6s %7.1f ns/value, %zu bytes\n", name, fmt,
+	    t * 1e9 / n, total);
+}
+
+static void
+run(const char *set, const double *v, size_t n)
+{
+	char buf[64];
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		estream_snprintf_shortest(buf, sizeof(buf), 'g', v[i]);
+		if (strtod(buf, NULL) != v[i])
+			errx(1, "%s does not read back as %.17g", buf, v[i]);
+	}
+
+	printf("%s:\n", set);
+	pass("libc", "%.17g", v, n, libc_fmt);
+	pass("shortest", "%g", v, n, shortest_fmt);
+	pass("libc", "%g", v, n, libc_fmt);
+	pass("estream", "%g", v, n, estream_fmt);
+	pass("libc", "%f", v, n, libc_fmt);
+	pass("estream", "%f", v, n, estream_fmt);
+	pass("libc", "%e", v, n, libc_fmt);
+	pass("estream", "%e", v, n, estream_fmt);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t i, n = 1000000;
+	uint64_t state = 1, bits;
+	double *v;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: double_bench [count]\n");
+		return 2;
+	}
+	if (argc == 2)
+		n = strtoul(argv[1], NULL, 10);
+	if (n == 0 || (v = calloc(n, sizeof(*v))) == NULL)
+		errx(1, "cannot allocate %zu values", n);
+
+	/* measurements with a few decimal places */
+	for (i = 0; i < n; i++)
+		v[i] = (double)(next(&state) % 100000000) / 1000;
+	run("decimals", v, n);
+
+	/* uniform in [0, 1e6): 16 or 17 significant digits */
+	for (i = 0; i < n; i++)
+		v[i] = (next(&state) >> 11) / 9007199254740992.0 * 1e6;
+	run("uniform", v, n);
+
+	/* random bit patterns over the whole finite range; "%f" of the
+	   large ones is long and dominated by the zeros */
+	for (i = 0; i < n; i++) {
+		do
+			bits = next(&state) & ~(1ULL << 63);
+		while ((bits >> 52) == 0x7ff);
+		memcpy(&v[i], &bits, sizeof(v[i]));
+	}
+	run("any", v, n);
+
+	free(v);
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Cost of a precompiled format, estream_format_exec(), against parsing
+ * the format on every call with estream_format().
+ *
+ * usage: format_bench [count]
+ *
+ * The output goes to a function that only counts it, so the numbers
+ * are those of the formatting itself; the byte counts of both ways
+ * must agree.
+ */
+
+#include <err.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "estream-printf.h"
+
+static const char *formats[] = {
+	"%d %s %x\n",
+	"%s: %5d of %-8s at %08lx (%u%%)\n",
+	"[%2$s] %1$d %3$s\n",
+	"%lu %ld %lu %ld %lu %ld %lu %ld %lu %ld\n",
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+count_out(void *arg, const char *buf, size_t len)
+{
+	(void)buf;
+	*(size_t *)arg += len;
+	return 0;
+}
+
+static int
+parsed(size_t *total, const void *fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	va_start(ap, fmt);
+	r = estream_format(count_out, total, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+static int
+compiled(size_t *total, const void *fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	va_start(ap, fmt);
+	r = estream_format_exec(count_out, total,
+	    (estream_format_t)fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+/* The same arguments suit every entry of formats[]. */
+static size_t
+pass(const char *name, int idx, const void *fmt, unsigned long n,
+    int (*fn)(size_t *, const void *, ...))
+{
+	size_t total = 0;
+	unsigned long i;
+	double t;
+
+	t = now();
+	for (i = 0; i < n; i++) {
+		switch (idx) {
+		case 0:
+			fn(&total, fmt, (int)i, "name", (unsigned)i);
+			break;
+		case 1:
+			fn(&total, fmt, "file", (int)i, "blocks", i,
+			    (unsigned)(i % 100));
+			break;
+		case 2:
+			fn(&total, fmt, (int)i, "tag", "value");
+			break;
+		case 3:
+			fn(&total, fmt, i, (long)i, i, (long)i, i, (long)i,
+			    i, (long)i, i, (long)i);
+			break;
+		}
+	}
+	t = now() - t;
+	printf("  %-9s %7.1f ns/call, %zu bytes\n", name, t * 1e9 / n,
+	    total);
+	return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+	estream_format_t fmt;
+	unsigned long n = 1000000;
+	size_t i;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: format_bench [count]\n");
+		return 2;
+	}
+	if (argc == 2)
+		n = strtoul(argv[1], NULL, 10);
+	if (n == 0)
+		errx(1, "count must be positive");
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if ((fmt = estream_format_compile(formats[i])) == NULL)
+			err(1, "estream_format_compile");
+		printf("\"%.*s\":\n", (int)strcspn(formats[i], "\n"),
+		    formats[i]);
+		if (pass("parsed", i, formats[i], n, parsed) !=
+		    pass("compiled", i, fmt, n, compiled))
+			errx(1, "byte counts differ");
+		estream_format_release(fmt);
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Throughput of getdelim() against the fgetc() loop it replaced.
+ *
+ * usage: getline_bench file [delimiter]
+ *
+ * Each pass reads the whole file line by line; the byte counts of both
+ * implementations must agree.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the previous implementation, one fgetc() call per byte */
+static ssize_t
+old_getdelim(char **buf, size_t *bufsiz, int delimiter, FILE *fp)
+{
+	char *ptr, *eptr;
+
+	if (*buf == NULL || *bufsiz == 0) {
+		*bufsiz = BUFSIZ;
+		if ((*buf = malloc(*bufsiz)) == NULL)
+			return -1;
+	}
+
+	for (ptr = *buf, eptr = *buf + *bufsiz;;) {
+		int c = fgetc(fp);
+		if (c == -1) {
+			if (feof(fp))
+				return ptr == *buf ? -1 : ptr - *buf;
+			else
+				return -1;
+		}
+		*ptr++ = c;
+		if (c == delimiter) {
+			*ptr = '\0';
+			return ptr - *buf;
+		}
+		if (ptr + 2 >= eptr) {
+			char *nbuf;
+			size_t nbufsiz = *bufsiz * 2;
+			ssize_t d = ptr - *buf;
+			if ((nbuf = realloc(*buf, nbufsiz)) == NULL)
+				return -1;
+			*buf = nbuf;
+			*bufsiz = nbufsiz;
+			eptr = nbuf + nbufsiz;
+			ptr = nbuf + d;
+		}
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+pass(const char *name, const char *path, int delim,
+    ssize_t (*fn)(char **, size_t *, int, FILE *))
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t bufsiz = 0, total = 0, lines = 0;
+	ssize_t r;
+	double t;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	t = now();
+	while ((r = fn(&buf, &bufsiz, delim, fp)) != -1) {
+		total += r;
+		lines++;
+	}
+	t = now() - t;
+	if (ferror(fp))
+		err(1, "%s", path);
+	fclose(fp);
+	free(buf);
+	printf("%-10s %zu lines, %zu bytes, %.3fs, %.1f MB/s\n", name,
+	    lines, total, t, t > 0 ? total / t / 1e6 : 0);
+	return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int delim = '\n';
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: getline_bench file [delimiter]\n");
+		return 2;
+	}
+	if (argc == 3)
+		delim = (unsigned char)argv[2][0];
+
+	/* the first pass also warms the page cache */
+	if (pass("fgetc", argv[1], delim, old_getdelim) !=
+	    pass("getdelim", argv[1], delim, getdelim))
+		errx(1, "byte counts differ");
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Compare asprintf() against the snprintf() of the C library.
+ *
+ * usage: printf_compat [locale ...]
+ *
+ * The checks run in the C locale and then in each locale given that
+ * setlocale() accepts, so that "%'d" is tried with real separators.
+ */
+
+#include <sys/types.h>
+#include <limits.h>
+#include <locale.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+static int failures;
+
+#define	CHECK(...) do {						\
+	reflen = snprintf(ref, sizeof(ref), __VA_ARGS__);		\
+	outlen = asprintf(&out, __VA_ARGS__);				\
+	check(__LINE__, reflen, ref, outlen, out);			\
+} while (0)
+
+static void
+check(int line, int reflen, const char *ref, int outlen, char *out)
+{
+	if (outlen != reflen || strcmp(out, ref) != 0) {
+		printf("line %d: libc %d \"%s\", asprintf %d \"%s\"\n", line,
+		    reflen, ref, outlen, outlen == -1 ? "" : out);
+		failures++;
+	}
+	if (outlen != -1)
+		free(out);
+}
+
+static void
+run(void)
+{
+	char ref[512], *out;
+	int reflen, outlen, x;
+
+	CHECK("%d %i %u %o %x %X", -42, 42, 42u, 42u, 0xbeefu, 0xbeefu);
+	CHECK("%hhd %hhu %hhx %hhd", 300, 300, 255, -129);
+	CHECK("%hd %hu %hd", 70000, 70000, -32769);
+	CHECK("%ld %lu %lld %llu", LONG_MIN, ULONG_MAX, LLONG_MIN,
+	    ULLONG_MAX);
+	CHECK("%jd %zu %td", INTMAX_MIN, SIZE_MAX, (ptrdiff_t)-1);
+	CHECK("[%5d|%-5d|%05d|%+d|% d|%.3d|%8.3d]", 7, 7, -7, 7, 7, 7, -7);
+	CHECK("[%#o|%#x|%#X|%#x|%.0d|%.0x]", 8u, 255u, 255u, 0u, 0, 0u);
+	CHECK("[%'d|%'u|%'d|%'lld|%'.8d]", 1234567, 999u, -1000, LLONG_MAX,
+	    12345);
+	CHECK("[%c|%5c|%-5c|%*c|%-*c]", 'a', 'b', 'c', 3, 'd', -3, 'e');
+	CHECK("[%p|%20p|%-20p]", (void *)&x, (void *)&x, (void *)&x);
+	CHECK("[%p|%20p|%-20p]", (void *)NULL, (void *)NULL, (void *)NULL);
+	CHECK("[%s|%10s|%-10s|%.2s|%*.*s]", "abc", "abc", "abc", "abc", 6, 1,
+	    "xyz");
+	CHECK("[%lc|%5ls|%ls]", (wint_t)'w', L"wide", L"");
+	CHECK("%2$s %1$d %3$c", 1, "two", '3');
+	CHECK("[%f|%.2f|%10.3e|%g|%G|%-12g|%+.0f]", 3.14159, 2.675, 12345.678,
+	    1e-5, 1e20, 0.5, 2.5);
+	CHECK("%n%d", &x, 5);
+	CHECK("%%|%s|%%", "x");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	run();
+	for (i = 1; i < argc; i++) {
+		if (setlocale(LC_ALL, argv[i]) == NULL) {
+			printf("%s: locale not available, skipped\n", argv[i]);
+			continue;
+		}
+		run();
+	}
+	if (failures) {
+		printf("%d mismatches\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -36,7 +36,11 @@
 #include <sys/types.h>
 
 #include <limits.h>
+#include <stdint.h>
 #include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define	wsize	sizeof(u_int)
 #define	wmask	(wsize - 1)
@@ -45,6 +49,17 @@
 #define	VAL	0
 #define	WIDEVAL	0
 
+/*
+ * With SSE2, buffers of 16 to 63 bytes are cleared with two or four
+ * overlapping unaligned 16 byte stores.  Larger ones use aligned
+ * stores, and from BZERO_NT_THRESHOLD bytes on non-temporal ones that
+ * bypass the caches, so that clearing a large buffer does not evict
+ * the working set.  Shorter buffers use the word loop below.
+ */
+#ifndef BZERO_NT_THRESHOLD
+#define	BZERO_NT_THRESHOLD	(4 * 1024 * 1024)
+#endif
+
 void
 bzero(void *dst0, size_t length)
 {
@@ -52,6 +67,48 @@ bzero(void *dst0, size_t length)
 	u_char *dst;
 
 	dst = dst0;
+#ifdef __SSE2__
+	if (length >= 16) {
+		const __m128i zero = _mm_setzero_si128();
+		u_char *end = dst + length;
+
+		if (length < 64) {
+			_mm_storeu_si128((__m128i *)dst, zero);
+			_mm_storeu_si128((__m128i *)(end - 16), zero);
+			if (length > 32) {
+				_mm_storeu_si128((__m128i *)dst + 1, zero);
+				_mm_storeu_si128((__m128i *)(end - 32), zero);
+			}
+			RETURN;
+		}
+
+		/* Unaligned head, then continue from the next boundary. */
+		_mm_storeu_si128((__m128i *)dst, zero);
+		dst = (u_char *)(((uintptr_t)dst + 16) & ~(uintptr_t)15);
+		length = end - dst;
+		if (length >= BZERO_NT_THRESHOLD) {
+			for (; length >= 64; length -= 64, dst += 64) {
+				_mm_stream_si128((__m128i *)dst, zero);
+				_mm_stream_si128((__m128i *)dst + 1, zero);
+				_mm_stream_si128((__m128i *)dst + 2, zero);
+				_mm_stream_si128((__m128i *)dst + 3, zero);
+			}
+			_mm_sfence();
+		} else
+			for (; length >= 64; length -= 64, dst += 64) {
+				_mm_store_si128((__m128i *)dst, zero);
+				_mm_store_si128((__m128i *)dst + 1, zero);
+				_mm_store_si128((__m128i *)dst + 2, zero);
+				_mm_store_si128((__m128i *)dst + 3, zero);
+			}
+		for (; length >= 16; length -= 16, dst += 16)
+			_mm_store_si128((__m128i *)dst, zero);
+		/* Unaligned tail, overlapping bytes already cleared. */
+		if (length != 0)
+			_mm_storeu_si128((__m128i *)(end - 16), zero);
+		RETURN;
+	}
+#endif
 	/*
 	 * If not enough words, just fill bytes.  A length >= 2 words
 	 * guarantees that at least one of them is `complete' after
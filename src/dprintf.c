@@ -1,25 +1,93 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include "estream-printf.h"
 
-int
-dprintf(int fd, const char *fmt, ...)
+/*
+ * The message is formatted by estream_format_noalloc, which collects
+ * the output in its 512 byte staging buffer and hands it to write(2)
+ * in as few calls as possible: a message that fits the buffer costs
+ * one system call and no memory is allocated.  The formatter refuses
+ * a format with more than 32 conversions or arguments before writing
+ * anything; such a format is handed to estream_format, which
+ * allocates its tables.  Conversions neither of them supports, such as
+ * %ls and %lc, go to the C library through a stdio stream on a
+ * duplicate of the descriptor.
+ */
+struct dprintf_parm {
+	int	fd;
+	size_t	total;		/* bytes written so far */
+};
+
+static int
+dprintf_out(void *arg, const char *buf, size_t len)
+{
+	struct dprintf_parm *parm = arg;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(parm->fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+		parm->total += n;
+	}
+	return 0;
+}
+
+static int
+dprintf_stdio(int fd, const char *fmt, __builtin_va_list ap)
 {
 	FILE *fp;
 	int e;
-	__builtin_va_list ap;
 
 	if ((e = dup(fd)) == -1)
 		return -1;
 
-	if ((fp = fdopen(e, "r+")) == NULL) {
+	if ((fp = fdopen(e, "w")) == NULL) {
 		(void)close(e);
 		return -1;
 	}
 
-	__builtin_va_start(ap, fmt);
 	e = vfprintf(fp, fmt, ap);
-	__builtin_va_end(ap);
-
-	(void)fclose(fp);
+	if (fclose(fp) == EOF)
+		e = -1;
 	return e;
 }
+
+int
+dprintf(int fd, const char *fmt, ...)
+{
+	struct dprintf_parm parm;
+	__builtin_va_list ap, ap2;
+	int e;
+
+	parm.fd = fd;
+	parm.total = 0;
+	__builtin_va_start(ap, fmt);
+	__builtin_va_copy(ap2, ap);
+	e = estream_format_noalloc(dprintf_out, &parm, fmt, ap);
+	if (e == -1 && errno == EINVAL && parm.total == 0) {
+		__builtin_va_end(ap);
+		__builtin_va_copy(ap, ap2);
+		e = estream_format(dprintf_out, &parm, fmt, ap);
+		if (e == -1 && errno == EINVAL && parm.total == 0) {
+			__builtin_va_end(ap2);
+			__builtin_va_end(ap);
+			__builtin_va_start(ap, fmt);
+			e = dprintf_stdio(fd, fmt, ap);
+			__builtin_va_end(ap);
+			return e;
+		}
+	}
+	__builtin_va_end(ap2);
+	__builtin_va_end(ap);
+	if (e == -1)
+		return -1;
+	return parm.total;
+}
@@ -25,20 +25,211 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/types.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "estream-printf.h"
+
+/*
+ * Every message is built completely, including the program name prefix,
+ * the error string and the newline, in a buffer on the caller's stack
+ * and written to stderr with a single write(2).  Messages of concurrent
+ * threads thus never interleave and no stdio lock is taken.  Messages
+ * which do not fit into the buffer are built in a malloced one.
+ */
+#define	ERR_BUFSIZE	1024
+
+struct warn_buf {
+	char	*buf;
+	size_t	 size;
+	size_t	 len;		/* full length of the message */
+};
+
+/* Rate limiting of identical messages, see warn_ratelimit(). */
+static pthread_mutex_t	warn_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int	warn_burst;
+static uint64_t		warn_last_hash;
+static size_t		warn_last_len;
+static unsigned long	warn_repeats;
+static unsigned long	warn_suppressed;
+
+static int
+warn_out(void *arg, const char *s, size_t n)
+{
+	struct warn_buf *wb = arg;
+
+	if (wb->len < wb->size)
+		memcpy(wb->buf + wb->len, s,
+		    n < wb->size - wb->len ? n : wb->size - wb->len);
+	wb->len += n;
+	return (0);
+}
+
+/*
+ * Build "progname: message[: strerror(code)]\n" in wb; code is -1 if
+ * no error string is wanted.
+ */
+static void
+warn_build(struct warn_buf *wb, int code, const char *fmt, va_list ap)
+{
+	const char *s;
+
+	wb->len = 0;
+	if ((s = getprogname()) != NULL) {
+		warn_out(wb, s, strlen(s));
+		warn_out(wb, ": ", 2);
+	}
+	if (fmt != NULL)
+		estream_format(warn_out, wb, fmt, ap);
+	if (code != -1) {
+		if (fmt != NULL)
+			warn_out(wb, ": ", 2);
+		s = strerror(code);
+		warn_out(wb, s, strlen(s));
+	}
+	warn_out(wb, "\n", 1);
+}
+
+static void
+warn_write(const char *s, size_t n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		r = write(STDERR_FILENO, s, n);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		s += r;
+		n -= r;
+	}
+}
+
+/* Report the messages dropped by the rate limiter; called locked. */
+static void
+warn_flush_repeats(void)
+{
+	char buf[ERR_BUFSIZE];
+	const char *s;
+	size_t n = 0;
+
+	if (warn_suppressed == 0)
+		return;
+	if ((s = getprogname()) != NULL)
+		n = estream_snprintf(buf, sizeof(buf), "%s: ", s);
+	if (n < sizeof(buf))
+		n += estream_snprintf(buf + n, sizeof(buf) - n,
+		    "last message repeated %lu times\n", warn_suppressed);
+	if (n >= sizeof(buf))
+		n = sizeof(buf) - 1;
+	warn_write(buf, n);
+	warn_suppressed = 0;
+}
+
+static void
+warn_emit(const char *msg, size_t len, int fatal)
+{
+	uint64_t h;
+	size_t i;
+
+	if (warn_burst == 0) {
+		warn_write(msg, len);
+		return;
+	}
+
+	/* FNV-1a */
+	h = 0xcbf29ce484222325ULL;
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)msg[i]) * 0x100000001b3ULL;
+
+	pthread_mutex_lock(&warn_lock);
+	if (!fatal && h == warn_last_hash && len == warn_last_len) {
+		if (++warn_repeats >= warn_burst) {
+			warn_suppressed++;
+			pthread_mutex_unlock(&warn_lock);
+			return;
+		}
+	} else {
+		warn_flush_repeats();
+		warn_last_hash = h;
+		warn_last_len = len;
+		warn_repeats = 0;
+	}
+	warn_write(msg, len);
+	pthread_mutex_unlock(&warn_lock);
+}
+
+static void
+vwarn_common(int code, const char *fmt, va_list ap, int fatal)
+{
+	char buf[ERR_BUFSIZE];
+	struct warn_buf wb;
+	va_list ap2;
+	int saved_errno = errno;
+
+	wb.buf = buf;
+	wb.size = sizeof(buf);
+	va_copy(ap2, ap);
+	warn_build(&wb, code, fmt, ap);
+	if (wb.len > sizeof(buf)) {
+		wb.size = wb.len;
+		if ((wb.buf = malloc(wb.size)) != NULL)
+			warn_build(&wb, code, fmt, ap2);
+		else {
+			wb.buf = buf;
+			wb.len = sizeof(buf);
+			buf[sizeof(buf) - 1] = '\n';
+		}
+	}
+	va_end(ap2);
+	warn_emit(wb.buf, wb.len, fatal);
+	if (wb.buf != buf)
+		free(wb.buf);
+	errno = saved_errno;
+}
+
+/*
+ * Limit the output of identical consecutive messages to burst; the
+ * ones beyond are counted and reported as "last message repeated N
+ * times" before the next different message.  A burst of 0 disables
+ * the limiter and reports any pending count.
+ */
+void
+warn_ratelimit(unsigned int burst)
+{
+	pthread_mutex_lock(&warn_lock);
+	warn_flush_repeats();
+	warn_burst = burst;
+	warn_last_len = 0;
+	warn_last_hash = 0;
+	warn_repeats = 0;
+	pthread_mutex_unlock(&warn_lock);
+}
+
+void
+vwarnc(int code, const char *format, va_list ap)
+{
+	vwarn_common(code, format, ap, 0);
+}
 
 void
 vwarn(const char *fmt, va_list ap)
 {
-	vwarnc(errno, fmt, ap);
+	vwarn_common(errno, fmt, ap, 0);
 }
 
 void
-verr(int eval, const char *fmt, va_list ap)
+vwarnx(const char *fmt, va_list ap)
 {
-	verrc(eval, errno, fmt, ap);
+	vwarn_common(-1, fmt, ap, 0);
 }
 
 void
@@ -52,13 +243,43 @@ warnc(int code, const char *format, ...)
 }
 
 void
-vwarnc(int code, const char *format, va_list ap)
+warn(const char *format, ...)
 {
-	int tmp = errno;
+	va_list ap;
 
-	errno = code;
+	va_start(ap, format);
 	vwarn(format, ap);
-	errno = tmp;
+	va_end(ap);
+}
+
+void
+warnx(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vwarnx(format, ap);
+	va_end(ap);
+}
+
+void
+verrc(int status, int code, const char *format, va_list ap)
+{
+	vwarn_common(code, format, ap, 1);
+	exit(status);
+}
+
+void
+verr(int eval, const char *fmt, va_list ap)
+{
+	verrc(eval, errno, fmt, ap);
+}
+
+void
+verrx(int eval, const char *fmt, va_list ap)
+{
+	vwarn_common(-1, fmt, ap, 1);
+	exit(eval);
 }
 
 void
@@ -72,8 +293,21 @@ errc(int status, int code, const char *format, ...)
 }
 
 void
-verrc(int status, int code, const char *format, va_list ap)
+err(int eval, const char *format, ...)
 {
-	errno = code;
-	verr(status, format, ap);
+	va_list ap;
+
+	va_start(ap, format);
+	verr(eval, format, ap);
+	va_end(ap);
+}
+
+void
+errx(int eval, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	verrx(eval, format, ap);
+	va_end(ap);
 }
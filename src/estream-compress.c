@@ -0,0 +1,527 @@
+/* estream-compress.c - Compressing cookies for estream
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The cookies in this file stack on top of an existing estream and
+ * transparently compress everything written to, or decompress
+ * everything read from, the returned stream.  They only use the
+ * public cookie interface of estream.
+ *
+ * The following macros select the available methods:
+ *
+ *   HAVE_ZLIB   ES_COMPRESS_GZIP (gzip framing, zlib deflate/inflate)
+ *   HAVE_ZSTD   ES_COMPRESS_ZSTD (zstd frames)
+ */
+
+#include <estream.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Size of the buffer for the compressed side of the stream.  */
+#define COMPRESS_BUFFER_SIZE 16384
+
+/* Cookie for compressing objects.  */
+typedef struct estream_cookie_compress
+{
+  estream_t base;               /* The stream with compressed data.  */
+  int method;                   /* One of the ES_COMPRESS_ values.  */
+  int writing;                  /* Compressing instead of decompressing. */
+  int base_eof;                 /* BASE has no more input.  */
+  int done;                     /* Decompressor hit the end of input.  */
+  unsigned char *buffer;        /* Compressed data buffer.  */
+  size_t buffer_size;           /* Allocated size of BUFFER.  */
+#ifdef HAVE_ZLIB
+  z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+  ZSTD_CStream *zcs;
+  ZSTD_DStream *zds;
+  ZSTD_inBuffer zin;
+  size_t zret;                  /* Last result of ZSTD_decompressStream.  */
+#endif
+} *estream_cookie_compress_t;
+
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+/* Read more compressed data from the base stream into the cookie
+   buffer.  Returns the number of bytes read, 0 at EOF or -1 on
+   error.  */
+static ssize_t
+compress_fill (estream_cookie_compress_t cookie)
+{
+  size_t nread;
+
+  if (cookie->base_eof)
+    return 0;
+  if (es_read (cookie->base, cookie->buffer, cookie->buffer_size, &nread))
+    return -1;
+  if (!nread)
+    cookie->base_eof = 1;
+  return nread;
+}
+#endif
+
+
+#ifdef HAVE_ZLIB
+/* Read function for gzip objects.  */
+static ssize_t
+es_func_gzip_read (void *c, void *buffer, size_t size)
+{
+  estream_cookie_compress_t cookie = c;
+  z_stream *zs = &cookie->zs;
+  unsigned int avail;
+  ssize_t nread;
+  int rc;
+
+  if (cookie->done || !size)
+    return 0;
+
+  avail = size > UINT_MAX? UINT_MAX : size;
+  zs->next_out = buffer;
+  zs->avail_out = avail;
+  while (zs->avail_out == avail)
+    {
+      if (!zs->avail_in)
+        {
+          nread = compress_fill (cookie);
+          if (nread == -1)
+            return -1;
+          if (!nread)
+            {
+              if (!zs->total_in)
+                {
+                  /* An empty base stream decompresses to nothing.  */
+                  cookie->done = 1;
+                  break;
+                }
+              /* Truncated input: the stream ended before the
+                 compressor said so.  */
+              errno = EIO;
+              return -1;
+            }
+          zs->next_in = cookie->buffer;
+          zs->avail_in = nread;
+        }
+
+      rc = inflate (zs, Z_NO_FLUSH);
+      if (rc == Z_STREAM_END)
+        {
+          /* Another gzip member may follow; only stop at the end of
+             the base stream.  */
+          if (!zs->avail_in)
+            {
+              nread = compress_fill (cookie);
+              if (nread == -1)
+                return -1;
+              zs->next_in = cookie->buffer;
+              zs->avail_in = nread;
+            }
+          if (!zs->avail_in)
+            {
+              cookie->done = 1;
+              break;
+            }
+          if (inflateReset (zs) != Z_OK)
+            {
+              errno = EIO;
+              return -1;
+            }
+        }
+      else if (rc == Z_MEM_ERROR)
+        {
+          errno = ENOMEM;
+          return -1;
+        }
+      else if (rc != Z_OK && rc != Z_BUF_ERROR)
+        {
+          errno = EIO;
+          return -1;
+        }
+    }
+
+  return avail - zs->avail_out;
+}
+
+
+/* Run the deflater with FLUSH and pass everything it produces on to
+   the base stream.  */
+static int
+gzip_deflate (estream_cookie_compress_t cookie, int flush)
+{
+  z_stream *zs = &cookie->zs;
+  size_t n;
+  int rc;
+
+  do
+    {
+      zs->next_out = cookie->buffer;
+      zs->avail_out = cookie->buffer_size;
+      rc = deflate (zs, flush);
+      if (rc == Z_STREAM_ERROR)
+        {
+          errno = EIO;
+          return -1;
+        }
+      n = cookie->buffer_size - zs->avail_out;
+      if (n && es_write (cookie->base, cookie->buffer, n, NULL))
+        return -1;
+    }
+  while (!zs->avail_out || (flush == Z_FINISH && rc != Z_STREAM_END));
+
+  return 0;
+}
+
+
+/* Write function for gzip objects.  */
+static ssize_t
+es_func_gzip_write (void *c, const void *buffer, size_t size)
+{
+  estream_cookie_compress_t cookie = c;
+  z_stream *zs = &cookie->zs;
+  size_t nleft = size;
+  size_t n;
+
+  /* A flush is a NOP: estream propagates one after every full buffer
+     and a sync flush there would ruin the compression ratio.  */
+  while (nleft)
+    {
+      n = nleft > UINT_MAX? UINT_MAX : nleft;
+      zs->next_in = (unsigned char *)buffer + (size - nleft);
+      zs->avail_in = n;
+      if (gzip_deflate (cookie, Z_NO_FLUSH))
+        return -1;
+      nleft -= n;
+    }
+
+  return size;
+}
+#endif /*HAVE_ZLIB*/
+
+
+#ifdef HAVE_ZSTD
+/* Read function for zstd objects.  */
+static ssize_t
+es_func_zstd_read (void *c, void *buffer, size_t size)
+{
+  estream_cookie_compress_t cookie = c;
+  ZSTD_outBuffer zout;
+  ssize_t nread;
+
+  if (cookie->done || !size)
+    return 0;
+
+  zout.dst = buffer;
+  zout.size = size;
+  zout.pos = 0;
+  while (!zout.pos)
+    {
+      if (cookie->zin.pos == cookie->zin.size && !cookie->base_eof)
+        {
+          nread = compress_fill (cookie);
+          if (nread == -1)
+            return -1;
+          cookie->zin.src = cookie->buffer;
+          cookie->zin.size = nread;
+          cookie->zin.pos = 0;
+        }
+
+      /* Even without new input this may flush pending output.  */
+      cookie->zret = ZSTD_decompressStream (cookie->zds, &zout, &cookie->zin);
+      if (ZSTD_isError (cookie->zret))
+        {
+          errno = EIO;
+          return -1;
+        }
+
+      if (!zout.pos && cookie->base_eof
+          && cookie->zin.pos == cookie->zin.size)
+        {
+          if (cookie->zret)
+            {
+              errno = EIO;  /* Truncated frame.  */
+              return -1;
+            }
+          cookie->done = 1;
+          break;
+        }
+    }
+
+  return zout.pos;
+}
+
+
+/* Run the zstd compressor in MODE and pass everything it produces on
+   to the base stream.  */
+static int
+zstd_compress (estream_cookie_compress_t cookie, ZSTD_inBuffer *zin,
+               ZSTD_EndDirective mode)
+{
+  ZSTD_outBuffer zout;
+  size_t rc;
+
+  do
+    {
+      zout.dst = cookie->buffer;
+      zout.size = cookie->buffer_size;
+      zout.pos = 0;
+      rc = ZSTD_compressStream2 (cookie->zcs, &zout, zin, mode);
+      if (ZSTD_isError (rc))
+        {
+          errno = EIO;
+          return -1;
+        }
+      if (zout.pos && es_write (cookie->base, cookie->buffer, zout.pos, NULL))
+        return -1;
+    }
+  while (mode == ZSTD_e_end? rc != 0 : zin->pos < zin->size);
+
+  return 0;
+}
+
+
+/* Write function for zstd objects.  */
+static ssize_t
+es_func_zstd_write (void *c, const void *buffer, size_t size)
+{
+  estream_cookie_compress_t cookie = c;
+  ZSTD_inBuffer zin;
+
+  /* See es_func_gzip_write for why a flush is ignored.  */
+  if (!size)
+    return 0;
+
+  zin.src = buffer;
+  zin.size = size;
+  zin.pos = 0;
+  if (zstd_compress (cookie, &zin, ZSTD_e_continue))
+    return -1;
+
+  return size;
+}
+#endif /*HAVE_ZSTD*/
+
+
+/* Destroy function for compressing objects.  This finishes the
+   compressed stream and closes the base stream.  */
+static int
+es_func_compress_destroy (void *c)
+{
+  estream_cookie_compress_t cookie = c;
+  int err = 0;
+
+  if (!cookie)
+    return 0;
+
+  switch (cookie->method)
+    {
+#ifdef HAVE_ZLIB
+    case ES_COMPRESS_GZIP:
+      if (cookie->writing)
+        {
+          cookie->zs.next_in = NULL;
+          cookie->zs.avail_in = 0;
+          err = gzip_deflate (cookie, Z_FINISH);
+          deflateEnd (&cookie->zs);
+        }
+      else
+        inflateEnd (&cookie->zs);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case ES_COMPRESS_ZSTD:
+      if (cookie->writing)
+        {
+          ZSTD_inBuffer zin;
+
+          zin.src = NULL;
+          zin.size = 0;
+          zin.pos = 0;
+          err = zstd_compress (cookie, &zin, ZSTD_e_end);
+          ZSTD_freeCStream (cookie->zcs);
+        }
+      else
+        ZSTD_freeDStream (cookie->zds);
+      break;
+#endif
+    default:
+      break;
+    }
+
+  if (es_fclose (cookie->base))
+    err = -1;
+  free (cookie->buffer);
+  free (cookie);
+
+  return err;
+}
+
+
+/* Return a new stream which compresses data written to it, or
+   decompresses data read from it, using METHOD.  The compressed data
+   is written to or read from STREAM.  MODE must be a plain read or
+   write mode; read-write streams are not supported.  LEVEL is the
+   compression level or -1 for the method's default.  On success the
+   new stream owns STREAM and closes it on es_fclose.  On error NULL
+   is returned, errno is set and STREAM is left untouched.  */
+estream_t
+es_fopencompress (estream_t ES__RESTRICT stream,
+                  const char *ES__RESTRICT mode, int method, int level)
+{
+  estream_cookie_compress_t cookie;
+  es_cookie_io_functions_t functions;
+  estream_t stream_new;
+  int writing;
+
+  if (!stream || !mode || strchr (mode, '+'))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (*mode == 'r')
+    writing = 0;
+  else if (*mode == 'w' || *mode == 'a')
+    writing = 1;
+  else
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  cookie = calloc (1, sizeof *cookie);
+  if (!cookie)
+    return NULL;
+  cookie->base = stream;
+  cookie->method = method;
+  cookie->writing = writing;
+  cookie->buffer_size = COMPRESS_BUFFER_SIZE;
+  cookie->buffer = malloc (cookie->buffer_size);
+  if (!cookie->buffer)
+    {
+      free (cookie);
+      return NULL;
+    }
+
+  memset (&functions, 0, sizeof functions);
+  switch (method)
+    {
+#ifdef HAVE_ZLIB
+    case ES_COMPRESS_GZIP:
+      {
+        int rc;
+
+        /* 16 selects gzip framing for deflate, 32 automatic zlib or
+           gzip header detection for inflate.  */
+        if (writing)
+          rc = deflateInit2 (&cookie->zs,
+                             level < 0? Z_DEFAULT_COMPRESSION : level,
+                             Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        else
+          rc = inflateInit2 (&cookie->zs, 15 + 32);
+        if (rc != Z_OK)
+          {
+            errno = rc == Z_MEM_ERROR? ENOMEM : EINVAL;
+            goto leave;
+          }
+        functions.func_read = es_func_gzip_read;
+        functions.func_write = es_func_gzip_write;
+      }
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case ES_COMPRESS_ZSTD:
+      if (writing)
+        {
+          cookie->zcs = ZSTD_createCStream ();
+          if (!cookie->zcs)
+            {
+              errno = ENOMEM;
+              goto leave;
+            }
+          if (level >= 0
+              && ZSTD_isError (ZSTD_CCtx_setParameter
+                               (cookie->zcs, ZSTD_c_compressionLevel, level)))
+            {
+              ZSTD_freeCStream (cookie->zcs);
+              errno = EINVAL;
+              goto leave;
+            }
+        }
+      else
+        {
+          cookie->zds = ZSTD_createDStream ();
+          if (!cookie->zds)
+            {
+              errno = ENOMEM;
+              goto leave;
+            }
+          ZSTD_initDStream (cookie->zds);
+        }
+      functions.func_read = es_func_zstd_read;
+      functions.func_write = es_func_zstd_write;
+      break;
+#endif
+    default:
+      (void)level;
+      errno = EOPNOTSUPP;
+      goto leave;
+    }
+  if (writing)
+    functions.func_read = NULL;
+  else
+    functions.func_write = NULL;
+  functions.func_close = es_func_compress_destroy;
+
+  stream_new = es_fopencookie (cookie, mode, functions);
+  if (!stream_new)
+    {
+      /* Don't let the destroy function close the caller's stream.  */
+      switch (method)
+        {
+#ifdef HAVE_ZLIB
+        case ES_COMPRESS_GZIP:
+          if (writing)
+            deflateEnd (&cookie->zs);
+          else
+            inflateEnd (&cookie->zs);
+          break;
+#endif
+#ifdef HAVE_ZSTD
+        case ES_COMPRESS_ZSTD:
+          if (writing)
+            ZSTD_freeCStream (cookie->zcs);
+          else
+            ZSTD_freeDStream (cookie->zds);
+          break;
+#endif
+        default:
+          break;
+        }
+      goto leave;
+    }
+  return stream_new;
+
+ leave:
+  free (cookie->buffer);
+  free (cookie);
+  return NULL;
+}
@@ -32,7 +32,7 @@
     ESTREAM_PRINTF_INIT which runs all required checks.
     See estream-printf.h for ways to tune this code.
 
-  Missing stuff:  wchar and wint_t
+  Missing stuff:  wchar and wint_t ("%lc" and "%ls" are rejected)
                   thousands_sep in pr_float.
 
 */
@@ -46,12 +46,52 @@
 #include <stddef.h>
 #include <assert.h>
 #include <stdint.h>
+#include <float.h>
+#include <limits.h>
+#include <locale.h>
+#include <langinfo.h>
 #include "estream-printf.h"
 
 #define my_printf_malloc(a) malloc((a))
 #define my_printf_free(a)   free((a))
 
 
+/* Internal names for the value types of estream.h.  */
+typedef es_valtype_t valtype_t;
+typedef es_value_t value_t;
+#define valueitem_s es_valueitem_s
+typedef es_valueitem_t valueitem_t;
+#define VALTYPE_UNSUPPORTED    ES_VALTYPE_UNSUPPORTED
+#define VALTYPE_CHAR           ES_VALTYPE_CHAR
+#define VALTYPE_SCHAR          ES_VALTYPE_SCHAR
+#define VALTYPE_UCHAR          ES_VALTYPE_UCHAR
+#define VALTYPE_SHORT          ES_VALTYPE_SHORT
+#define VALTYPE_USHORT         ES_VALTYPE_USHORT
+#define VALTYPE_INT            ES_VALTYPE_INT
+#define VALTYPE_UINT           ES_VALTYPE_UINT
+#define VALTYPE_LONG           ES_VALTYPE_LONG
+#define VALTYPE_ULONG          ES_VALTYPE_ULONG
+#define VALTYPE_LONGLONG       ES_VALTYPE_LONGLONG
+#define VALTYPE_ULONGLONG      ES_VALTYPE_ULONGLONG
+#define VALTYPE_DOUBLE         ES_VALTYPE_DOUBLE
+#define VALTYPE_LONGDOUBLE     ES_VALTYPE_LONGDOUBLE
+#define VALTYPE_STRING         ES_VALTYPE_STRING
+#define VALTYPE_INTMAX         ES_VALTYPE_INTMAX
+#define VALTYPE_UINTMAX        ES_VALTYPE_UINTMAX
+#define VALTYPE_SIZE           ES_VALTYPE_SIZE
+#define VALTYPE_PTRDIFF        ES_VALTYPE_PTRDIFF
+#define VALTYPE_POINTER        ES_VALTYPE_POINTER
+#define VALTYPE_CHAR_PTR       ES_VALTYPE_CHAR_PTR
+#define VALTYPE_SCHAR_PTR      ES_VALTYPE_SCHAR_PTR
+#define VALTYPE_SHORT_PTR      ES_VALTYPE_SHORT_PTR
+#define VALTYPE_INT_PTR        ES_VALTYPE_INT_PTR
+#define VALTYPE_LONG_PTR       ES_VALTYPE_LONG_PTR
+#define VALTYPE_LONGLONG_PTR   ES_VALTYPE_LONGLONG_PTR
+#define VALTYPE_INTMAX_PTR     ES_VALTYPE_INTMAX_PTR
+#define VALTYPE_SIZE_PTR       ES_VALTYPE_SIZE_PTR
+#define VALTYPE_PTRDIFF_PTR    ES_VALTYPE_PTRDIFF_PTR
+
+
 /* Calculate array dimension.  */
 #ifndef DIM
 #define DIM(array) (sizeof (array) / sizeof (*array))
@@ -64,9 +104,19 @@
 /* We allow for that many values without requiring malloced memory. */
 #define DEFAULT_MAX_VALUES  8
 
+/* The limits of estream_format_noalloc, which never allocates.  */
+#define NOALLOC_MAX_ARGSPECS  32
+#define NOALLOC_MAX_VALUES    32
+
 /* We allocate this many new array argspec elements each time.  */
 #define ARGSPECS_BUMP_VALUE   10
 
+/* Doubles in IEEE binary64 format are converted by our own code;
+   other floating point types are passed on to sprintf.  */
+#if FLT_RADIX == 2 && DBL_MANT_DIG == 53 && DBL_MAX_EXP == 1024
+# define ESTREAM_NATIVE_DOUBLE 1
+#endif
+
 /* Special values for the field width and the precision.  */
 #define NO_FIELD_VALUE   (-1)
 #define STAR_FIELD_VALUE (-2)
@@ -78,6 +128,7 @@
 #define FLAG_SPACE_PLUS 8
 #define FLAG_ALT_CONV   16
 #define FLAG_ZERO_PAD   32
+#define FLAG_SHORTEST   64  /* Only set by estream_snprintf_shortest.  */
 
 /* Constants used the length modifiers.  */
 typedef enum
@@ -118,76 +169,6 @@ typedef enum
   } conspec_t;
 
 
-/* Constants describing all the suppoorted types.  Note that we list
-   all the types we know about even if certain types are not available
-   on this system. */
-typedef enum
-  {
-    VALTYPE_UNSUPPORTED = 0,  /* Artificial type for error detection.  */
-    VALTYPE_CHAR,
-    VALTYPE_SCHAR,
-    VALTYPE_UCHAR,
-    VALTYPE_SHORT,
-    VALTYPE_USHORT,
-    VALTYPE_INT,
-    VALTYPE_UINT,
-    VALTYPE_LONG,
-    VALTYPE_ULONG,
-    VALTYPE_LONGLONG,
-    VALTYPE_ULONGLONG,
-    VALTYPE_DOUBLE,
-    VALTYPE_LONGDOUBLE,
-    VALTYPE_STRING,
-    VALTYPE_INTMAX,
-    VALTYPE_UINTMAX,
-    VALTYPE_SIZE,
-    VALTYPE_PTRDIFF,
-    VALTYPE_POINTER,
-    VALTYPE_CHAR_PTR,
-    VALTYPE_SCHAR_PTR,
-    VALTYPE_SHORT_PTR,
-    VALTYPE_INT_PTR,
-    VALTYPE_LONG_PTR,
-    VALTYPE_LONGLONG_PTR,
-    VALTYPE_INTMAX_PTR,
-    VALTYPE_SIZE_PTR,
-    VALTYPE_PTRDIFF_PTR
-  } valtype_t;
-
-
-/* A union used to store the actual values. */
-typedef union 
-{
-  char a_char;
-  signed char a_schar;
-  unsigned char a_uchar;
-  short a_short;
-  unsigned short a_ushort;
-  int a_int;
-  unsigned int a_uint;
-  long int a_long;
-  unsigned long int a_ulong;
-  long long int a_longlong;
-  unsigned long long int a_ulonglong;
-  double a_double;
-  long double a_longdouble;
-  const char *a_string;
-  intmax_t a_intmax;
-  intmax_t a_uintmax;
-  size_t a_size;
-  ptrdiff_t a_ptrdiff;
-  void *a_void_ptr;
-  char *a_char_ptr;
-  signed char *a_schar_ptr;
-  short *a_short_ptr;
-  int  *a_int_ptr;
-  long *a_long_ptr;
-  long long int *a_longlong_ptr;
-  intmax_t *a_intmax_ptr;
-  size_t *a_size_ptr;
-  ptrdiff_t *a_ptrdiff_ptr;
-} value_t;
-
 /* An object used to keep track of a format option and arguments. */
 struct argspec_s
 {
@@ -208,13 +189,6 @@ struct argspec_s
 };
 typedef struct argspec_s *argspec_t;
 
-/* An object to build up a table of values and their types.  */
-struct valueitem_s
-{
-  valtype_t vt;  /* The type of the value.  */
-  value_t value; /* The value.  */
-};
-typedef struct valueitem_s *valueitem_t;
 
 
 #ifdef DEBUG
@@ -300,11 +274,13 @@ compute_type (argspec_t arg)
       break;
       
     case CONSPEC_CHAR:
-      arg->vt = VALTYPE_INT; 
+      /* Wide characters are not supported.  */
+      arg->vt = arg->lenmod == LENMOD_LONG? VALTYPE_UNSUPPORTED : VALTYPE_INT;
       break;
 
     case CONSPEC_STRING:
-      arg->vt = VALTYPE_STRING;
+      arg->vt = (arg->lenmod == LENMOD_LONG? VALTYPE_UNSUPPORTED
+                 : VALTYPE_STRING);
       break;
 
     case CONSPEC_POINTER:
@@ -723,6 +699,136 @@ pad_out (estream_printf_out_t outfnc, void *outfncarg,
 }
 
 
+/* The decimal representation of 0 to 99, used to convert two digits
+   at a time.  */
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static const unsigned long long powers_of_ten[] =
+  {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+  };
+
+
+/* Return the number of decimal digits of VALUE; 0 has one digit.  */
+static int
+count_digits (unsigned long long value)
+{
+  int bits, t;
+
+  /* Setting the low bit does not change the result but makes sure
+     that 0 is counted as one digit.  */
+  value |= 1;
+#ifdef __GNUC__
+  bits = 64 - __builtin_clzll (value);
+#else
+  {
+    unsigned long long v;
+
+    for (bits = 0, v = value; v; v >>= 1)
+      bits++;
+  }
+#endif
+  /* 1233/4096 approximates log10(2); T is either the number of digits
+     of VALUE or one less.  */
+  t = (bits * 1233) >> 12;
+  return t + 1 - (value < powers_of_ten[t]);
+}
+
+
+/* Store the N decimal digits of VALUE at BUFFER, which must have room
+   for them.  N must have been computed by count_digits.  */
+static void
+put_decimal (char *buffer, int n, unsigned long long value)
+{
+  char *p = buffer + n;
+  unsigned int i;
+
+  while (value >= 100)
+    {
+      i = (unsigned int)(value % 100) * 2;
+      value /= 100;
+      *--p = digit_pairs[i + 1];
+      *--p = digit_pairs[i];
+    }
+  if (value >= 10)
+    {
+      i = (unsigned int)value * 2;
+      *--p = digit_pairs[i + 1];
+      *--p = digit_pairs[i];
+    }
+  else
+    *--p = '0' + (char)value;
+}
+
+
+/* Store the decimal digits of VALUE without a terminating Nul at
+   BUFFER, which must have room for 20 characters.  Returns the number
+   of digits.  */
+size_t
+estream_ulltoa (char *buffer, unsigned long long value)
+{
+  int n = count_digits (value);
+
+  put_decimal (buffer, n, value);
+  return n;
+}
+
+
+/* Longest thousands separator we insert; a longer one is ignored.  */
+#define MAX_THOUSANDS_SEP 8
+
+/* Copy the N digits at DIGITS to the end of the buffer ending at END
+   with the thousands separator of the current locale inserted as its
+   grouping rules say.  The buffer needs room for N digits and N-1
+   separators.  Returns the start of the grouped string or NULL if the
+   locale does not group digits.  */
+static char *
+group_digits (const char *digits, size_t n, char *end)
+{
+  const struct lconv *lc = localeconv ();
+  const char *grouping = lc->grouping;
+  const char *src = digits + n;
+  size_t seplen = strlen (lc->thousands_sep);
+  int left;
+
+  if (!seplen || seplen > MAX_THOUSANDS_SEP
+      || *grouping <= 0 || *grouping == CHAR_MAX)
+    return NULL;
+
+  left = *grouping;
+  while (src > digits)
+    {
+      if (!left)
+        {
+          end -= seplen;
+          memcpy (end, lc->thousands_sep, seplen);
+          /* The last group size repeats; CHAR_MAX ends the grouping.  */
+          if (grouping[1])
+            grouping++;
+          left = (*grouping <= 0 || *grouping == CHAR_MAX)? -1 : *grouping;
+        }
+      *--end = *--src;
+      left--;
+    }
+  return end;
+}
+
+
 /* "d,i,o,u,x,X" formatting.  OUTFNC and OUTFNCARG describes the
    output routine, ARG gives the argument description and VALUE the
    actual value (its type is available through arg->vt).  */
@@ -733,11 +839,13 @@ pr_integer (estream_printf_out_t outfnc, void *outfncarg,
   int rc;
   unsigned long long aulong;
   char numbuf[100];
-  char *p, *pend;
+  char groupbuf[20 + 19 * MAX_THOUSANDS_SEP];
+  char *p, *pend, *g;
   size_t n;
   char signchar = 0;
   int n_prec;  /* Number of extra precision digits required.  */
   int n_extra; /* Extra number of prefix or sign characters.  */
+  int hexprefix = 0; /* Print "0x" or "0X".  */
 
   if (arg->conspec == CONSPEC_DECIMAL)
     {
@@ -745,6 +853,7 @@ pr_integer (estream_printf_out_t outfnc, void *outfncarg,
 
       switch (arg->vt)
         {
+        case VALTYPE_SCHAR: along = value.a_schar; break;
         case VALTYPE_SHORT: along = value.a_short; break;
         case VALTYPE_INT: along = value.a_int; break;
         case VALTYPE_LONG: along = value.a_long; break;  
@@ -767,6 +876,7 @@ pr_integer (estream_printf_out_t outfnc, void *outfncarg,
     {
       switch (arg->vt)
         {
+        case VALTYPE_UCHAR: aulong = value.a_uchar; break;
         case VALTYPE_USHORT: aulong = value.a_ushort; break;
         case VALTYPE_UINT: aulong = value.a_uint; break;
         case VALTYPE_ULONG: aulong = value.a_ulong; break;  
@@ -795,22 +905,15 @@ pr_integer (estream_printf_out_t outfnc, void *outfncarg,
   else if (arg->conspec == CONSPEC_DECIMAL
            || arg->conspec == CONSPEC_UNSIGNED)
     {
-      int grouping = -1;
-      const char * grouping_string =
-        "'";
-
-      do
+      n = count_digits (aulong);
+      p = pend - n;
+      put_decimal (p, n, aulong);
+      if ((arg->flags & FLAG_GROUPING) && n > 1
+          && (g = group_digits (p, n, groupbuf + DIM(groupbuf))))
         {
-          if ((arg->flags & FLAG_GROUPING) 
-              && (++grouping == 3) && *grouping_string)
-            {
-              *--p = *grouping_string;
-              grouping = 0;
-            }
-          *--p = '0' + (aulong % 10);
-          aulong /= 10;
+          p = g;
+          pend = groupbuf + DIM(groupbuf);
         }
-      while (aulong);
     }
   else if (arg->conspec == CONSPEC_OCTAL)
     {
@@ -827,13 +930,16 @@ pr_integer (estream_printf_out_t outfnc, void *outfncarg,
     {
       const char *digits = ((arg->conspec == CONSPEC_HEX)
                             ? "0123456789abcdef" : "0123456789ABCDEF");
+
+      /* As in C99 the prefix is not printed for zero.  */
+      hexprefix = (arg->flags & FLAG_ALT_CONV) && aulong;
       do
         {
           *--p = digits[(aulong % 16)];
           aulong /= 16;
         }
       while (aulong);
-      if ((arg->flags & FLAG_ALT_CONV))
+      if (hexprefix)
         n_extra += 2;
     }
   
@@ -866,8 +972,7 @@ pr_integer (estream_printf_out_t outfnc, void *outfncarg,
       *nbytes += 1;
     }
 
-  if ((arg->flags & FLAG_ALT_CONV)
-      && (arg->conspec == CONSPEC_HEX || arg->conspec == CONSPEC_HEX_UP))
+  if (hexprefix)
     {
       rc = outfnc (outfncarg, arg->conspec == CONSPEC_HEX? "0x": "0X", 2);
       if (rc)
@@ -900,241 +1005,1291 @@ pr_integer (estream_printf_out_t outfnc, void *outfncarg,
 }
 
 
-/* "e,E,f,F,g,G,a,A" formatting.  OUTFNC and OUTFNCARG describes the
-   output routine, ARG gives the argument description and VALUE the
-   actual value (its type is available through arg->vt).  For
-   portability reasons sprintf is used for the actual formatting.
-   This is useful because sprint is the only standard function to
-   convert a floating number into its ascii representation.  To avoid
-   using malloc we just pass the precision to sprintf and do the final
-   formatting with our own code.  */
-static int
-pr_float (estream_printf_out_t outfnc, void *outfncarg,
-          argspec_t arg, value_t value, size_t *nbytes)
+#ifdef ESTREAM_NATIVE_DOUBLE
+/* Native conversion of IEEE doubles.  The digits are computed exactly
+   using the algorithm of Steele & White in the form given by Burger
+   and Dybvig ("Printing Floating-Point Numbers Quickly and Accurately",
+   PLDI 1996): the value and its rounding interval are represented as
+   quotients of big integers which are scaled by a power of ten so
+   that one digit can be produced per step.  The shortest mode first
+   tries the faster Grisu3 method, which needs a table of powers of
+   ten, and falls back to the exact method when that fails.  */
+
+/* 40 limbs are enough for 2^1076 scaled by 10^324 and some slack for
+   the normalization shift.  */
+#define BIGNUM_LIMBS 40
+
+/* The largest number of significant digits a double may have plus
+   some slack.  Digits beyond this are always zero.  */
+#define MAX_DOUBLE_DIGITS 780
+
+struct bignum_s
 {
-  int rc;
-  long double adblfloat = 0; /* Just to please gcc.  */
-  int use_dbl = 0;
-  double afloat;
-  char numbuf[350];
-  char formatstr[20];
-  char *p, *pend;
-  size_t n;
-  char signchar = 0;
-  int n_extra;  /* Extra number of prefix or sign characters.  */
+  int len;                   /* Number of used limbs.  */
+  uint32_t d[BIGNUM_LIMBS];  /* The limbs, least significant first.  */
+};
 
-  switch (arg->vt)
-    {
-    case VALTYPE_DOUBLE: afloat = value.a_double; break;
-    case VALTYPE_LONGDOUBLE:
-      afloat = 0;  /* Just to please gcc.  */
-      adblfloat = value.a_longdouble;
-      use_dbl=1; break;
-    default: 
-      return -1;
-    }
+/* Modes for double_to_digits.  */
+#define DTOA_SHORTEST    0   /* Shortest string reading back exactly.  */
+#define DTOA_SIGNIFICANT 1   /* Given number of significant digits.  */
+#define DTOA_FRACTION    2   /* Given number of fractional digits.  */
 
-  /* We build the string using sprint.  */
-  p = formatstr + sizeof formatstr;
-  *--p = 0;
-  switch (arg->conspec)
-    {
-    case CONSPEC_FLOAT:      *--p = 'f'; break;
-    case CONSPEC_FLOAT_UP:   *--p = 'F'; break;
-    case CONSPEC_EXP:        *--p = 'e'; break;
-    case CONSPEC_EXP_UP:     *--p = 'E'; break;
-    case CONSPEC_F_OR_G:     *--p = 'g'; break;
-    case CONSPEC_F_OR_G_UP:  *--p = 'G'; break;
-    case CONSPEC_HEX_EXP:    *--p = 'a'; break;
-    case CONSPEC_HEX_EXP_UP: *--p = 'A'; break;
-    default:
-      return -1; /* Actually a bug.  */
-    }
-  if (use_dbl)
-    *--p = 'L';
-  if (arg->precision != NO_FIELD_VALUE)
+
+static void
+bn_set (struct bignum_s *a, uint64_t v)
+{
+  a->d[0] = (uint32_t)v;
+  a->d[1] = (uint32_t)(v >> 32);
+  a->len = a->d[1]? 2 : a->d[0]? 1 : 0;
+}
+
+
+static void
+bn_shl (struct bignum_s *a, unsigned int n)
+{
+  unsigned int w = n / 32;
+  unsigned int b = n % 32;
+  int i;
+
+  if (!a->len)
+    return;
+  assert (a->len + w + 1 <= BIGNUM_LIMBS);
+  if (b)
     {
-      /* Limit it to a meaningful value so that even a stupid sprintf
-         won't overflow our buffer.  */
-      n = arg->precision <= 100? arg->precision : 100;
-      do
-        {
-          *--p = '0' + (n % 10);
-          n /= 10;
-        }
-      while (n);
-      *--p = '.';
+      a->d[a->len + w] = a->d[a->len - 1] >> (32 - b);
+      for (i = a->len - 1; i > 0; i--)
+        a->d[i + w] = (a->d[i] << b) | (a->d[i - 1] >> (32 - b));
+      a->d[w] = a->d[0] << b;
+      a->len += w + 1;
+      if (!a->d[a->len - 1])
+        a->len--;
     }
-  if ((arg->flags & FLAG_ALT_CONV))
-    *--p = '#';
-  *--p = '%';
-  if (use_dbl)
-    sprintf (numbuf, p, adblfloat);
   else
-    sprintf (numbuf, p, afloat);
-  p = numbuf;
-  n = strlen (numbuf);
-  pend = p + n;
-
-  if (*p =='-')
     {
-      signchar = '-';
-      p++;
-      n--;
+      for (i = a->len - 1; i >= 0; i--)
+        a->d[i + w] = a->d[i];
+      a->len += w;
     }
-  else if ((arg->flags & FLAG_PLUS_SIGN))
-    signchar = '+';
-  else if ((arg->flags & FLAG_SPACE_PLUS))
-    signchar = ' ';
+  for (i = 0; i < w; i++)
+    a->d[i] = 0;
+}
 
-  n_extra = !!signchar;
 
-  if (!(arg->flags & FLAG_LEFT_JUST)
-      && arg->width >= 0 && arg->width - n_extra > n)
-    {
-      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n_extra - n, nbytes);
-      if (rc)
-        return rc;
-    }
+static void
+bn_mul_small (struct bignum_s *a, uint32_t m)
+{
+  uint64_t carry = 0;
+  int i;
 
-  if (signchar)
+  for (i = 0; i < a->len; i++)
     {
-      rc = outfnc (outfncarg, &signchar, 1);
-      if (rc)
-        return rc;
-      *nbytes += 1;
+      carry += (uint64_t)a->d[i] * m;
+      a->d[i] = (uint32_t)carry;
+      carry >>= 32;
     }
-
-  rc = outfnc (outfncarg, p, pend - p);
-  if (rc)
-    return rc;
-  *nbytes += pend - p;
-
-  if ((arg->flags & FLAG_LEFT_JUST)
-      && arg->width >= 0 && arg->width - n_extra > n)
+  if (carry)
     {
-      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n_extra - n, nbytes);
-      if (rc)
-        return rc;
+      assert (a->len < BIGNUM_LIMBS);
+      a->d[a->len++] = (uint32_t)carry;
     }
+}
 
-  return 0;
+
+static void
+bn_mul_pow10 (struct bignum_s *a, int n)
+{
+  for (; n >= 9; n -= 9)
+    bn_mul_small (a, 1000000000);
+  if (n)
+    bn_mul_small (a, (uint32_t)powers_of_ten[n]);
 }
 
 
-/* "c" formatting.  */
 static int
-pr_char (estream_printf_out_t outfnc, void *outfncarg,
-            argspec_t arg, value_t value, size_t *nbytes)
+bn_cmp (const struct bignum_s *a, const struct bignum_s *b)
 {
-  int rc;
-  char buf[1];
+  int i;
 
-  if (arg->vt != VALTYPE_INT)
-    return -1;
-  buf[0] = (unsigned int)value.a_int;
-  rc = outfnc (outfncarg, buf, 1);
-  if(rc)
-    return rc;
-  *nbytes += 1;
-  
+  if (a->len != b->len)
+    return a->len < b->len? -1 : 1;
+  for (i = a->len - 1; i >= 0; i--)
+    if (a->d[i] != b->d[i])
+      return a->d[i] < b->d[i]? -1 : 1;
   return 0;
 }
 
 
-/* "s" formatting.  */
-static int
-pr_string (estream_printf_out_t outfnc, void *outfncarg,
-            argspec_t arg, value_t value, size_t *nbytes)
+/* Store A + B at R.  */
+static void
+bn_add (struct bignum_s *r, const struct bignum_s *a, const struct bignum_s *b)
 {
-  int rc;
-  size_t n;
-  const char *string, *s;
+  uint64_t carry = 0;
+  int i, n;
 
-  if (arg->vt != VALTYPE_STRING)
-    return -1;
-  string = value.a_string;
-  if (!string)
-    string = "(null)";
-  if (arg->precision >= 0)
+  if (a->len < b->len)
     {
-      for (n=0,s=string; *s && n < arg->precision; s++) 
-        n++;
+      const struct bignum_s *tmp = a;
+      a = b;
+      b = tmp;
     }
-  else
-    n = strlen (string);
-
-  if (!(arg->flags & FLAG_LEFT_JUST)
-      && arg->width >= 0 && arg->width > n )
+  n = a->len;
+  for (i = 0; i < n; i++)
     {
-      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n, nbytes);
-      if (rc)
-        return rc;
+      carry += (uint64_t)a->d[i] + (i < b->len? b->d[i] : 0);
+      r->d[i] = (uint32_t)carry;
+      carry >>= 32;
+    }
+  r->len = n;
+  if (carry)
+    {
+      assert (n < BIGNUM_LIMBS);
+      r->d[r->len++] = 1;
     }
+}
 
-  rc = outfnc (outfncarg, string, n);
-  if (rc)
-    return rc;
-  *nbytes += n;
 
-  if ((arg->flags & FLAG_LEFT_JUST)
-      && arg->width >= 0 && arg->width > n)
+/* Subtract Q * B from A.  The result must not be negative.  */
+static void
+bn_submul (struct bignum_s *a, const struct bignum_s *b, uint32_t q)
+{
+  uint64_t carry = 0;
+  uint64_t borrow = 0;
+  uint64_t diff;
+  int i;
+
+  for (i = 0; i < a->len; i++)
     {
-      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n, nbytes);
-      if (rc)
-        return rc;
+      carry += i < b->len? (uint64_t)b->d[i] * q : 0;
+      diff = (uint64_t)a->d[i] - (uint32_t)carry - borrow;
+      a->d[i] = (uint32_t)diff;
+      borrow = (diff >> 32) & 1;
+      carry >>= 32;
     }
-  
-  return 0;
+  while (a->len && !a->d[a->len - 1])
+    a->len--;
 }
 
 
-/* "p" formatting.  */
+/* Return the next digit R / S and replace R by the remainder.  R must
+   be less than 10 * S and the top limb of S must be in the range
+   [8, 429496729] so that the estimate is off by at most one.  */
 static int
-pr_pointer (estream_printf_out_t outfnc, void *outfncarg,
-            argspec_t arg, value_t value, size_t *nbytes)
+bn_next_digit (struct bignum_s *r, const struct bignum_s *s)
 {
-  int rc;
-  unsigned long long aulong;
-  char numbuf[100];
-  char *p, *pend;
-
-  if (arg->vt != VALTYPE_POINTER)
-    return -1;
-  /* We assume that a pointer can be converted to an unsigned long.
-     That is not correct for a 64 bit Windows, but then we assume that
-     long long is supported and usable for storing a pointer.  */
-  aulong = (unsigned long long)value.a_void_ptr;
-
-  p = pend = numbuf + DIM(numbuf);
-  do
+  int t = s->len - 1;
+  uint32_t q;
+
+  if (r->len < s->len)
+    return 0;
+  assert (r->len == s->len);
+  q = r->d[t] / (s->d[t] + 1);
+  if (q)
+    bn_submul (r, s, q);
+  while (bn_cmp (r, s) >= 0)
     {
-      *--p = "0123456789abcdefx"[(aulong % 16)];
-      aulong /= 16;
+      bn_submul (r, s, 1);
+      q++;
     }
-  while (aulong);
-  while ((pend-p) < 2*sizeof (aulong))
-    *--p = '0';
-  *--p = 'x';
-  *--p = '0';
-  
-  rc = outfnc (outfncarg, p, pend - p);
-  if (rc)
-    return rc;
-  *nbytes += pend - p;
-
-  return 0;
+  return q;
 }
 
-/* "n" pesudo format operation.  */
+
+/* Return floor(X * log10(2)).  */
 static int
-pr_bytes_so_far (estream_printf_out_t outfnc, void *outfncarg,
-                 argspec_t arg, value_t value, size_t *nbytes)
+floor_log10_pow2 (int x)
 {
-  (void)outfnc;
-  (void)outfncarg;
+  /* 78913 / 2^18 is log10(2) rounded down; this is exact for all
+     exponents a double may have.  */
+  if (x >= 0)
+    return (x * 78913) >> 18;
+  return -((-x * 78913 + (1 << 18) - 1) >> 18);
+}
 
-  switch (arg->vt)
+
+/* Add one unit in the last place to the ND digits at DIGITS.  Returns
+   the new number of digits without trailing zeros and increments
+   *R_K if all digits were nines.  */
+static int
+round_up_digits (char *digits, int nd, int *r_k)
+{
+  while (nd && digits[nd - 1] == '9')
+    nd--;
+  if (!nd)
+    {
+      digits[0] = '1';
+      ++*r_k;
+      return 1;
+    }
+  digits[nd - 1]++;
+  return nd;
+}
+
+
+/* Fast path: Grisu3 from Loitsch, "Printing Floating-Point Numbers
+   Quickly and Accurately with Integers" (PLDI 2010).  The value (and
+   for DTOA_SHORTEST its boundaries) is scaled by a cached power of
+   ten in 64 bit arithmetic; the few values for which the imprecision
+   of that scaling leaves the result in doubt are rejected and handled
+   by the bignum code.  That is about 0.5% of them for the shortest
+   mode and fewer for a small number of digits.  */
+
+/* 10^K as a normalized 64 bit significand F times 2^E, for K from
+   -348 to 340 in steps of 8.  */
+static const struct
+{
+  uint64_t f;
+  short e;
+  short k;
+} cached_powers[] =
+  {
+    { 0xfa8fd5a0081c0288ULL, -1220, -348 },
+    { 0xbaaee17fa23ebf76ULL, -1193, -340 },
+    { 0x8b16fb203055ac76ULL, -1166, -332 },
+    { 0xcf42894a5dce35eaULL, -1140, -324 },
+    { 0x9a6bb0aa55653b2dULL, -1113, -316 },
+    { 0xe61acf033d1a45dfULL, -1087, -308 },
+    { 0xab70fe17c79ac6caULL, -1060, -300 },
+    { 0xff77b1fcbebcdc4fULL, -1034, -292 },
+    { 0xbe5691ef416bd60cULL, -1007, -284 },
+    { 0x8dd01fad907ffc3cULL,  -980, -276 },
+    { 0xd3515c2831559a83ULL,  -954, -268 },
+    { 0x9d71ac8fada6c9b5ULL,  -927, -260 },
+    { 0xea9c227723ee8bcbULL,  -901, -252 },
+    { 0xaecc49914078536dULL,  -874, -244 },
+    { 0x823c12795db6ce57ULL,  -847, -236 },
+    { 0xc21094364dfb5637ULL,  -821, -228 },
+    { 0x9096ea6f3848984fULL,  -794, -220 },
+    { 0xd77485cb25823ac7ULL,  -768, -212 },
+    { 0xa086cfcd97bf97f4ULL,  -741, -204 },
+    { 0xef340a98172aace5ULL,  -715, -196 },
+    { 0xb23867fb2a35b28eULL,  -688, -188 },
+    { 0x84c8d4dfd2c63f3bULL,  -661, -180 },
+    { 0xc5dd44271ad3cdbaULL,  -635, -172 },
+    { 0x936b9fcebb25c996ULL,  -608, -164 },
+    { 0xdbac6c247d62a584ULL,  -582, -156 },
+    { 0xa3ab66580d5fdaf6ULL,  -555, -148 },
+    { 0xf3e2f893dec3f126ULL,  -529, -140 },
+    { 0xb5b5ada8aaff80b8ULL,  -502, -132 },
+    { 0x87625f056c7c4a8bULL,  -475, -124 },
+    { 0xc9bcff6034c13053ULL,  -449, -116 },
+    { 0x964e858c91ba2655ULL,  -422, -108 },
+    { 0xdff9772470297ebdULL,  -396, -100 },
+    { 0xa6dfbd9fb8e5b88fULL,  -369,  -92 },
+    { 0xf8a95fcf88747d94ULL,  -343,  -84 },
+    { 0xb94470938fa89bcfULL,  -316,  -76 },
+    { 0x8a08f0f8bf0f156bULL,  -289,  -68 },
+    { 0xcdb02555653131b6ULL,  -263,  -60 },
+    { 0x993fe2c6d07b7facULL,  -236,  -52 },
+    { 0xe45c10c42a2b3b06ULL,  -210,  -44 },
+    { 0xaa242499697392d3ULL,  -183,  -36 },
+    { 0xfd87b5f28300ca0eULL,  -157,  -28 },
+    { 0xbce5086492111aebULL,  -130,  -20 },
+    { 0x8cbccc096f5088ccULL,  -103,  -12 },
+    { 0xd1b71758e219652cULL,   -77,   -4 },
+    { 0x9c40000000000000ULL,   -50,    4 },
+    { 0xe8d4a51000000000ULL,   -24,   12 },
+    { 0xad78ebc5ac620000ULL,     3,   20 },
+    { 0x813f3978f8940984ULL,    30,   28 },
+    { 0xc097ce7bc90715b3ULL,    56,   36 },
+    { 0x8f7e32ce7bea5c70ULL,    83,   44 },
+    { 0xd5d238a4abe98068ULL,   109,   52 },
+    { 0x9f4f2726179a2245ULL,   136,   60 },
+    { 0xed63a231d4c4fb27ULL,   162,   68 },
+    { 0xb0de65388cc8ada8ULL,   189,   76 },
+    { 0x83c7088e1aab65dbULL,   216,   84 },
+    { 0xc45d1df942711d9aULL,   242,   92 },
+    { 0x924d692ca61be758ULL,   269,  100 },
+    { 0xda01ee641a708deaULL,   295,  108 },
+    { 0xa26da3999aef774aULL,   322,  116 },
+    { 0xf209787bb47d6b85ULL,   348,  124 },
+    { 0xb454e4a179dd1877ULL,   375,  132 },
+    { 0x865b86925b9bc5c2ULL,   402,  140 },
+    { 0xc83553c5c8965d3dULL,   428,  148 },
+    { 0x952ab45cfa97a0b3ULL,   455,  156 },
+    { 0xde469fbd99a05fe3ULL,   481,  164 },
+    { 0xa59bc234db398c25ULL,   508,  172 },
+    { 0xf6c69a72a3989f5cULL,   534,  180 },
+    { 0xb7dcbf5354e9beceULL,   561,  188 },
+    { 0x88fcf317f22241e2ULL,   588,  196 },
+    { 0xcc20ce9bd35c78a5ULL,   614,  204 },
+    { 0x98165af37b2153dfULL,   641,  212 },
+    { 0xe2a0b5dc971f303aULL,   667,  220 },
+    { 0xa8d9d1535ce3b396ULL,   694,  228 },
+    { 0xfb9b7cd9a4a7443cULL,   720,  236 },
+    { 0xbb764c4ca7a44410ULL,   747,  244 },
+    { 0x8bab8eefb6409c1aULL,   774,  252 },
+    { 0xd01fef10a657842cULL,   800,  260 },
+    { 0x9b10a4e5e9913129ULL,   827,  268 },
+    { 0xe7109bfba19c0c9dULL,   853,  276 },
+    { 0xac2820d9623bf429ULL,   880,  284 },
+    { 0x80444b5e7aa7cf85ULL,   907,  292 },
+    { 0xbf21e44003acdd2dULL,   933,  300 },
+    { 0x8e679c2f5e44ff8fULL,   960,  308 },
+    { 0xd433179d9c8cb841ULL,   986,  316 },
+    { 0x9e19db92b4e31ba9ULL,  1013,  324 },
+    { 0xeb96bf6ebadf77d9ULL,  1039,  332 },
+    { 0xaf87023b9bf0ee6bULL,  1066,  340 }
+  };
+
+#define CACHED_POWERS_MIN_K  (-348)
+#define CACHED_POWERS_STEP   8
+
+struct diyfp_s
+{
+  uint64_t f;
+  int e;
+};
+
+
+/* Return X * Y rounded to the upper 64 bits.  */
+static struct diyfp_s
+diyfp_mul (struct diyfp_s x, struct diyfp_s y)
+{
+  struct diyfp_s r;
+  uint64_t a = x.f >> 32, b = x.f & 0xffffffff;
+  uint64_t c = y.f >> 32, d = y.f & 0xffffffff;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp;
+
+  tmp = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff);
+  tmp += (uint64_t)1 << 31;  /* Round.  */
+  r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+
+static struct diyfp_s
+diyfp_normalize (struct diyfp_s x)
+{
+  while (!(x.f & ((uint64_t)1 << 63)))
+    {
+      x.f <<= 1;
+      x.e--;
+    }
+  return x;
+}
+
+
+/* Return the index of the cached power of ten which brings the
+   exponent of its product with a normalized number of exponent E into
+   [-60, -32]; the smallest one allowing for the digit loops.  */
+static int
+cached_power_index (int e)
+{
+  int x = -60 - (e + 64) + 63;
+
+  x = x? floor_log10_pow2 (x) + 1 : 0;
+  return (x - CACHED_POWERS_MIN_K - 1) / CACHED_POWERS_STEP + 1;
+}
+
+
+/* Remove the digits beyond the value closest to W from the LEN digits
+   at DIGITS and return true if the result is known to be the shortest
+   and closest one; see Loitsch for the meaning of the arguments.  */
+static int
+grisu_round_weed (char *digits, int len, uint64_t distance_too_high_w,
+                  uint64_t unsafe_interval, uint64_t rest,
+                  uint64_t ten_kappa, uint64_t unit)
+{
+  uint64_t small_distance = distance_too_high_w - unit;
+  uint64_t big_distance = distance_too_high_w + unit;
+
+  while (rest < small_distance
+         && unsafe_interval - rest >= ten_kappa
+         && (rest + ten_kappa < small_distance
+             || small_distance - rest >= rest + ten_kappa - small_distance))
+    {
+      digits[len - 1]--;
+      rest += ten_kappa;
+    }
+  if (rest < big_distance
+      && unsafe_interval - rest >= ten_kappa
+      && (rest + ten_kappa < big_distance
+          || big_distance - rest > rest + ten_kappa - big_distance))
+    return 0;
+  return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+
+/* Try to convert F * 2^E as double_to_digits does in DTOA_SHORTEST
+   mode.  Returns 0 if the result would be uncertain.  */
+static int
+grisu_shortest (uint64_t f, int e, int boundary_low, char *digits, int *r_k)
+{
+  struct diyfp_s w, mplus, mminus, c, too_low, too_high;
+  uint64_t one_mask, integrals, fractionals, divisor, rest;
+  uint64_t unsafe_interval, unit;
+  int one_e, kappa, len, i;
+
+  mplus.f = (f << 1) + 1;
+  mplus.e = e - 1;
+  mplus = diyfp_normalize (mplus);
+  if (boundary_low)
+    {
+      mminus.f = (f << 2) - 1;
+      mminus.e = e - 2;
+    }
+  else
+    {
+      mminus.f = (f << 1) - 1;
+      mminus.e = e - 1;
+    }
+  mminus.f <<= mminus.e - mplus.e;
+  mminus.e = mplus.e;
+  w.f = f;
+  w.e = e;
+  w = diyfp_normalize (w);
+
+  i = cached_power_index (w.e);
+  c.f = cached_powers[i].f;
+  c.e = cached_powers[i].e;
+
+  w = diyfp_mul (w, c);
+  too_low = diyfp_mul (mminus, c);
+  too_high = diyfp_mul (mplus, c);
+
+  /* The rounding of the products is off by at most one unit.  */
+  unit = 1;
+  too_low.f -= unit;
+  too_high.f += unit;
+  unsafe_interval = too_high.f - too_low.f;
+  one_e = -w.e;
+  one_mask = ((uint64_t)1 << one_e) - 1;
+  integrals = too_high.f >> one_e;
+  fractionals = too_high.f & one_mask;
+
+  /* INTEGRALS fits into 32 bits here.  */
+  kappa = count_digits (integrals);
+  divisor = powers_of_ten[kappa - 1];
+  len = 0;
+  while (kappa > 0)
+    {
+      digits[len++] = '0' + integrals / divisor;
+      integrals %= divisor;
+      kappa--;
+      rest = (integrals << one_e) + fractionals;
+      if (rest < unsafe_interval)
+        {
+          if (!grisu_round_weed (digits, len, too_high.f - w.f,
+                                 unsafe_interval, rest, divisor << one_e,
+                                 unit))
+            return 0;
+          goto leave;
+        }
+      divisor /= 10;
+    }
+  for (;;)
+    {
+      fractionals *= 10;
+      unit *= 10;
+      unsafe_interval *= 10;
+      digits[len++] = '0' + (fractionals >> one_e);
+      fractionals &= one_mask;
+      kappa--;
+      if (fractionals < unsafe_interval)
+        {
+          if (!grisu_round_weed (digits, len, (too_high.f - w.f) * unit,
+                                 unsafe_interval, fractionals, one_mask + 1,
+                                 unit))
+            return 0;
+          goto leave;
+        }
+    }
+
+ leave:
+  while (len > 1 && digits[len - 1] == '0')
+    len--;
+  *r_k = kappa - cached_powers[i].k + len;
+  return len;
+}
+
+
+/* Round the LEN digits at DIGITS, which are followed by REST in units
+   of TEN_KAPPA, each with an error of UNIT.  Returns false if the
+   direction is in doubt.  */
+static int
+grisu_round_counted (char *digits, int len, uint64_t rest,
+                     uint64_t ten_kappa, uint64_t unit, int *r_kappa)
+{
+  if (unit >= ten_kappa || ten_kappa - unit <= unit)
+    return 0;
+  if (ten_kappa - rest > rest && ten_kappa - 2 * rest >= 2 * unit)
+    return 1;  /* Round down.  */
+  if (rest > unit && ten_kappa - (rest - unit) <= rest - unit)
+    {
+      /* Round up.  */
+      while (len > 1 && digits[len - 1] == '9')
+        digits[--len] = '0';
+      if (digits[len - 1] == '9')
+        {
+          digits[0] = '1';
+          ++*r_kappa;
+        }
+      else
+        digits[len - 1]++;
+      return 1;
+    }
+  return 0;
+}
+
+
+/* Try to convert F * 2^E as double_to_digits does in DTOA_SIGNIFICANT
+   or DTOA_FRACTION mode.  Returns 0 if the result would be uncertain
+   or needs more digits than this method can produce.  */
+static int
+grisu_counted (uint64_t f, int e, int mode, int ndigits,
+               char *digits, int *r_k)
+{
+  struct diyfp_s w, c;
+  uint64_t one_mask, fractionals, divisor, rest, w_error;
+  uint64_t integrals;
+  int one_e, kappa, len, i, n;
+
+  w.f = f;
+  w.e = e;
+  w = diyfp_normalize (w);
+  i = cached_power_index (w.e);
+  c.f = cached_powers[i].f;
+  c.e = cached_powers[i].e;
+  w = diyfp_mul (w, c);
+
+  /* The rounding of the product is off by at most one unit.  */
+  w_error = 1;
+  one_e = -w.e;
+  one_mask = ((uint64_t)1 << one_e) - 1;
+  integrals = w.f >> one_e;
+  fractionals = w.f & one_mask;
+  kappa = count_digits (integrals);
+  divisor = powers_of_ten[kappa - 1];
+
+  /* The first digit is that of 10^(KAPPA - 1 - K).  */
+  n = mode == DTOA_FRACTION? kappa - cached_powers[i].k + ndigits : ndigits;
+  if (n < 1 || n > 18)
+    return 0;
+
+  len = 0;
+  while (kappa > 0)
+    {
+      digits[len++] = '0' + integrals / divisor;
+      integrals %= divisor;
+      kappa--;
+      if (len == n)
+        {
+          rest = (integrals << one_e) + fractionals;
+          if (!grisu_round_counted (digits, len, rest, divisor << one_e,
+                                    w_error, &kappa))
+            return 0;
+          goto leave;
+        }
+      divisor /= 10;
+    }
+  while (len < n && fractionals > w_error)
+    {
+      fractionals *= 10;
+      w_error *= 10;
+      digits[len++] = '0' + (fractionals >> one_e);
+      fractionals &= one_mask;
+      kappa--;
+    }
+  if (len < n || !grisu_round_counted (digits, len, fractionals,
+                                       one_mask + 1, w_error, &kappa))
+    return 0;
+
+ leave:
+  *r_k = kappa - cached_powers[i].k + len;
+  while (len > 1 && digits[len - 1] == '0')
+    len--;
+  return len;
+}
+
+
+/* Convert the positive value F * 2^E to decimal.  BOUNDARY_LOW is
+   true if the next lower double is closer than the next higher one.
+   MODE is one of the DTOA_ constants and NDIGITS the number of
+   significant or fractional digits for the fixed modes.  The digits
+   are stored without trailing zeros at DIGITS and their number is
+   returned; the value is 0.D * 10^*R_K.  */
+static int
+double_to_digits (uint64_t f, int e, int boundary_low, int mode, int ndigits,
+                  char *digits, int *r_k)
+{
+  struct bignum_s r, s, mplus, mminus_buf;
+  struct bignum_s *mminus;
+  struct bignum_s tmp;
+  int k, n, nd, shift, c, low, high, even;
+  unsigned int d;
+
+  if (mode == DTOA_SHORTEST)
+    nd = grisu_shortest (f, e, boundary_low, digits, r_k);
+  else
+    nd = grisu_counted (f, e, mode, ndigits, digits, r_k);
+  if (nd)
+    return nd;
+
+  /* Set up R / S = value and, for the shortest mode, the distance
+     to the neighbouring doubles as MPLUS / S and MMINUS / S, all
+     scaled by 2 (4 for a boundary) so that the midpoints are
+     integral.  */
+  mminus = &mplus;
+  bn_set (&r, f);
+  bn_set (&s, 1);
+  if (mode == DTOA_SHORTEST)
+    {
+      bn_set (&mplus, 1);
+      n = boundary_low? 2 : 1;
+      bn_shl (&r, n);
+      bn_shl (&s, n);
+      if (boundary_low)
+        {
+          mminus = &mminus_buf;
+          bn_set (mminus, 1);
+          bn_shl (&mplus, 1);
+        }
+      if (e >= 0)
+        {
+          bn_shl (&r, e);
+          bn_shl (&mplus, e);
+          if (mminus != &mplus)
+            bn_shl (mminus, e);
+        }
+      else
+        bn_shl (&s, -e);
+    }
+  else if (e >= 0)
+    bn_shl (&r, e);
+  else
+    bn_shl (&s, -e);
+
+  /* Estimate K from the binary exponent; it may be one too low.  */
+  for (n = 0; (f >> n) > 1; n++)
+    ;
+  k = floor_log10_pow2 (e + n) + 1;
+  if (k >= 0)
+    bn_mul_pow10 (&s, k);
+  else
+    {
+      bn_mul_pow10 (&r, -k);
+      if (mode == DTOA_SHORTEST)
+        {
+          bn_mul_pow10 (&mplus, -k);
+          if (mminus != &mplus)
+            bn_mul_pow10 (mminus, -k);
+        }
+    }
+
+  even = !(f & 1);
+  for (;;)
+    {
+      if (mode == DTOA_SHORTEST)
+        {
+          bn_add (&tmp, &r, &mplus);
+          c = bn_cmp (&tmp, &s);
+          c = even? c >= 0 : c > 0;
+        }
+      else
+        c = bn_cmp (&r, &s) >= 0;
+      if (!c)
+        break;
+      bn_mul_small (&s, 10);
+      k++;
+    }
+
+  /* Normalize so that the top limb of S is suitable for
+     bn_next_digit.  */
+  for (n = 0; (s.d[s.len - 1] >> n) > 1; n++)
+    ;
+  shift = (27 - n + 32) % 32;
+  bn_shl (&r, shift);
+  bn_shl (&s, shift);
+  if (mode == DTOA_SHORTEST)
+    {
+      bn_shl (&mplus, shift);
+      if (mminus != &mplus)
+        bn_shl (mminus, shift);
+    }
+
+  nd = 0;
+  if (mode == DTOA_SHORTEST)
+    {
+      for (;;)
+        {
+          bn_mul_small (&r, 10);
+          bn_mul_small (&mplus, 10);
+          if (mminus != &mplus)
+            bn_mul_small (mminus, 10);
+          d = bn_next_digit (&r, &s);
+          c = bn_cmp (&r, mminus);
+          low = even? c <= 0 : c < 0;
+          bn_add (&tmp, &r, &mplus);
+          c = bn_cmp (&tmp, &s);
+          high = even? c >= 0 : c > 0;
+          if (low || high)
+            break;
+          digits[nd++] = '0' + d;
+        }
+      if (low && high)
+        {
+          /* Both digits read back correctly; pick the nearer one.  */
+          bn_shl (&r, 1);
+          c = bn_cmp (&r, &s);
+          high = c > 0 || (!c && (d & 1));
+        }
+      digits[nd++] = '0' + d;
+      if (high)
+        nd = round_up_digits (digits, nd, &k);
+      *r_k = k;
+      return nd;
+    }
+
+  n = mode == DTOA_FRACTION? k + ndigits : ndigits;
+  if (n > MAX_DOUBLE_DIGITS)
+    n = MAX_DOUBLE_DIGITS;
+  if (n < 0)
+    return 0;
+  for (; nd < n && r.len; nd++)
+    {
+      bn_mul_small (&r, 10);
+      digits[nd] = '0' + bn_next_digit (&r, &s);
+    }
+  /* Round half to even using the remainder.  */
+  if (r.len)
+    {
+      bn_shl (&r, 1);
+      c = bn_cmp (&r, &s);
+      if (c > 0 || (!c && nd && (digits[nd - 1] & 1)))
+        nd = round_up_digits (digits, nd, &k);
+    }
+  while (nd && digits[nd - 1] == '0')
+    nd--;
+  *r_k = k;
+  return nd;
+}
+
+
+/* Output COUNT digits starting at position START of the ND digits at
+   DIGITS.  Positions outside of the digits are zeros.  */
+static int
+out_digits (estream_printf_out_t outfnc, void *outfncarg,
+            const char *digits, int nd, int start, int count,
+            size_t *nbytes)
+{
+  int rc, n;
+
+  if (count <= 0)
+    return 0;
+  if (start < 0)
+    {
+      n = -start < count? -start : count;
+      rc = pad_out (outfnc, outfncarg, '0', n, nbytes);
+      if (rc)
+        return rc;
+      start += n;
+      count -= n;
+    }
+  if (count && start < nd)
+    {
+      n = nd - start < count? nd - start : count;
+      rc = outfnc (outfncarg, digits + start, n);
+      if (rc)
+        return rc;
+      *nbytes += n;
+      start += n;
+      count -= n;
+    }
+  if (count)
+    return pad_out (outfnc, outfncarg, '0', count, nbytes);
+  return 0;
+}
+
+
+/* "e,E,f,F,g,G" formatting of doubles with RADIX as the decimal
+   point.  With FLAG_SHORTEST, as used by estream_snprintf_shortest,
+   the precision is ignored and the shortest digit string which
+   converts back to the same value is used.  For "g" the precision
+   still sets the exponent limit for the plain notation but never
+   drops digits.  */
+static int
+pr_double (estream_printf_out_t outfnc, void *outfncarg,
+           argspec_t arg, double afloat, char radix, size_t *nbytes)
+{
+  int rc;
+  uint64_t bits, f;
+  int e, bexp;
+  char digits[MAX_DOUBLE_DIGITS + 1];
+  int nd, k, x;
+  int upper, use_exp, prec, nfrac, n_extra, show_point;
+  char expbuf[6];
+  const char *special;
+  char *p, *pend;
+  char signchar = 0;
+  size_t n;
+
+  memcpy (&bits, &afloat, sizeof bits);
+  bexp = (int)((bits >> 52) & 0x7ff);
+  f = bits & ((((uint64_t)1) << 52) - 1);
+
+  if ((bits >> 63))
+    signchar = '-';
+  else if ((arg->flags & FLAG_PLUS_SIGN))
+    signchar = '+';
+  else if ((arg->flags & FLAG_SPACE_PLUS))
+    signchar = ' ';
+  n_extra = !!signchar;
+
+  upper = (arg->conspec == CONSPEC_FLOAT_UP
+           || arg->conspec == CONSPEC_EXP_UP
+           || arg->conspec == CONSPEC_F_OR_G_UP);
+
+  if (bexp == 0x7ff)
+    {
+      special = f? (upper? "NAN" : "nan") : (upper? "INF" : "inf");
+      n = 3;
+      if (!(arg->flags & FLAG_LEFT_JUST)
+          && arg->width >= 0 && arg->width - n_extra > n)
+        {
+          rc = pad_out (outfnc, outfncarg, ' ',
+                        arg->width - n_extra - n, nbytes);
+          if (rc)
+            return rc;
+        }
+      if (signchar)
+        {
+          rc = outfnc (outfncarg, &signchar, 1);
+          if (rc)
+            return rc;
+          *nbytes += 1;
+        }
+      rc = outfnc (outfncarg, special, n);
+      if (rc)
+        return rc;
+      *nbytes += n;
+      if ((arg->flags & FLAG_LEFT_JUST)
+          && arg->width >= 0 && arg->width - n_extra > n)
+        {
+          rc = pad_out (outfnc, outfncarg, ' ',
+                        arg->width - n_extra - n, nbytes);
+          if (rc)
+            return rc;
+        }
+      return 0;
+    }
+
+  prec = arg->precision == NO_FIELD_VALUE? 6 : arg->precision;
+  if (bexp)
+    {
+      e = bexp - 1075;
+      f |= ((uint64_t)1) << 52;
+    }
+  else
+    e = -1074;
+
+  /* Compute the digits.  X is the decimal exponent of the first
+     digit.  */
+  if (!f)
+    {
+      nd = 0;
+      k = 1;
+    }
+  else if ((arg->flags & FLAG_SHORTEST))
+    nd = double_to_digits (f, e, !(bits & ((((uint64_t)1) << 52) - 1))
+                           && bexp > 1,
+                           DTOA_SHORTEST, 0, digits, &k);
+  else if (arg->conspec == CONSPEC_FLOAT || arg->conspec == CONSPEC_FLOAT_UP)
+    nd = double_to_digits (f, e, 0, DTOA_FRACTION, prec, digits, &k);
+  else if (arg->conspec == CONSPEC_EXP || arg->conspec == CONSPEC_EXP_UP)
+    nd = double_to_digits (f, e, 0, DTOA_SIGNIFICANT, prec + 1, digits, &k);
+  else
+    nd = double_to_digits (f, e, 0, DTOA_SIGNIFICANT, prec? prec : 1,
+                           digits, &k);
+  if (!nd)
+    k = 1;
+  x = k - 1;
+
+  /* Decide on the notation and the number of fractional digits.  */
+  switch (arg->conspec)
+    {
+    case CONSPEC_FLOAT:
+    case CONSPEC_FLOAT_UP:
+      use_exp = 0;
+      if ((arg->flags & FLAG_SHORTEST))
+        nfrac = nd - 1 - x > 0? nd - 1 - x : 0;
+      else
+        nfrac = prec;
+      break;
+
+    case CONSPEC_EXP:
+    case CONSPEC_EXP_UP:
+      use_exp = 1;
+      if ((arg->flags & FLAG_SHORTEST))
+        nfrac = nd > 1? nd - 1 : 0;
+      else
+        nfrac = prec;
+      break;
+
+    default: /* F_OR_G and F_OR_G_UP */
+      if (!prec)
+        prec = 1;
+      if ((arg->flags & FLAG_SHORTEST) && nd > prec)
+        prec = nd;
+      use_exp = (x < -4 || x >= prec);
+      if ((arg->flags & FLAG_ALT_CONV) && !(arg->flags & FLAG_SHORTEST))
+        nfrac = use_exp? prec - 1 : prec - 1 - x;
+      else
+        {
+          nfrac = use_exp? nd - 1 : nd - 1 - x;
+          if (nfrac < 0)
+            nfrac = 0;
+        }
+      break;
+    }
+  show_point = nfrac > 0 || (arg->flags & FLAG_ALT_CONV);
+
+  /* Compute the length of the number.  */
+  pend = expbuf + sizeof expbuf;
+  p = pend;
+  if (use_exp)
+    {
+      e = x < 0? -x : x;
+      do
+        {
+          *--p = '0' + e % 10;
+          e /= 10;
+        }
+      while (e);
+      if (pend - p < 2)
+        *--p = '0';
+      *--p = x < 0? '-' : '+';
+      *--p = upper? 'E' : 'e';
+      n = 1;
+    }
+  else
+    n = x >= 0? x + 1 : 1;
+  n += show_point + nfrac + (pend - p);
+
+  if (!(arg->flags & FLAG_LEFT_JUST) && !(arg->flags & FLAG_ZERO_PAD)
+      && arg->width >= 0 && arg->width - n_extra > n)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n_extra - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  if (signchar)
+    {
+      rc = outfnc (outfncarg, &signchar, 1);
+      if (rc)
+        return rc;
+      *nbytes += 1;
+    }
+
+  if (!(arg->flags & FLAG_LEFT_JUST) && (arg->flags & FLAG_ZERO_PAD)
+      && arg->width >= 0 && arg->width - n_extra > n)
+    {
+      rc = pad_out (outfnc, outfncarg, '0', arg->width - n_extra - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  if (use_exp)
+    rc = out_digits (outfnc, outfncarg, digits, nd, 0, 1, nbytes);
+  else
+    rc = out_digits (outfnc, outfncarg, digits, nd, x < 0? -1 : 0,
+                     x >= 0? x + 1 : 1, nbytes);
+  if (rc)
+    return rc;
+  if (show_point)
+    {
+      rc = outfnc (outfncarg, &radix, 1);
+      if (rc)
+        return rc;
+      *nbytes += 1;
+    }
+  rc = out_digits (outfnc, outfncarg, digits, nd, use_exp? 1 : x + 1, nfrac,
+                   nbytes);
+  if (rc)
+    return rc;
+  if (use_exp)
+    {
+      rc = outfnc (outfncarg, p, pend - p);
+      if (rc)
+        return rc;
+      *nbytes += pend - p;
+    }
+
+  if ((arg->flags & FLAG_LEFT_JUST)
+      && arg->width >= 0 && arg->width - n_extra > n)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n_extra - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  return 0;
+}
+#endif /*ESTREAM_NATIVE_DOUBLE*/
+
+
+/* "e,E,f,F,g,G,a,A" formatting.  OUTFNC and OUTFNCARG describes the
+   output routine, ARG gives the argument description and VALUE the
+   actual value (its type is available through arg->vt).  For
+   portability reasons sprintf is used for the actual formatting.
+   This is useful because sprint is the only standard function to
+   convert a floating number into its ascii representation.  To avoid
+   using malloc we just pass the precision to sprintf and do the final
+   formatting with our own code.  RADIX is the decimal point used for
+   doubles we convert ourselves.  */
+static int
+pr_float (estream_printf_out_t outfnc, void *outfncarg,
+          argspec_t arg, value_t value, char radix, size_t *nbytes)
+{
+  int rc;
+  long double adblfloat = 0; /* Just to please gcc.  */
+  int use_dbl = 0;
+  double afloat;
+  char numbuf[350];
+  char formatstr[20];
+  char *p, *pend;
+  size_t n;
+  char signchar = 0;
+  int n_extra;  /* Extra number of prefix or sign characters.  */
+
+#ifdef ESTREAM_NATIVE_DOUBLE
+  if (arg->vt == VALTYPE_DOUBLE
+      && arg->conspec != CONSPEC_HEX_EXP && arg->conspec != CONSPEC_HEX_EXP_UP)
+    return pr_double (outfnc, outfncarg, arg, value.a_double, radix, nbytes);
+#endif
+
+  switch (arg->vt)
+    {
+    case VALTYPE_DOUBLE: afloat = value.a_double; break;
+    case VALTYPE_LONGDOUBLE:
+      afloat = 0;  /* Just to please gcc.  */
+      adblfloat = value.a_longdouble;
+      use_dbl=1; break;
+    default: 
+      return -1;
+    }
+
+  /* We build the string using sprint.  */
+  p = formatstr + sizeof formatstr;
+  *--p = 0;
+  switch (arg->conspec)
+    {
+    case CONSPEC_FLOAT:      *--p = 'f'; break;
+    case CONSPEC_FLOAT_UP:   *--p = 'F'; break;
+    case CONSPEC_EXP:        *--p = 'e'; break;
+    case CONSPEC_EXP_UP:     *--p = 'E'; break;
+    case CONSPEC_F_OR_G:     *--p = 'g'; break;
+    case CONSPEC_F_OR_G_UP:  *--p = 'G'; break;
+    case CONSPEC_HEX_EXP:    *--p = 'a'; break;
+    case CONSPEC_HEX_EXP_UP: *--p = 'A'; break;
+    default:
+      return -1; /* Actually a bug.  */
+    }
+  if (use_dbl)
+    *--p = 'L';
+  if (arg->precision != NO_FIELD_VALUE)
+    {
+      /* Limit it to a meaningful value so that even a stupid sprintf
+         won't overflow our buffer.  */
+      n = arg->precision <= 100? arg->precision : 100;
+      do
+        {
+          *--p = '0' + (n % 10);
+          n /= 10;
+        }
+      while (n);
+      *--p = '.';
+    }
+  if ((arg->flags & FLAG_ALT_CONV))
+    *--p = '#';
+  *--p = '%';
+  if (use_dbl)
+    sprintf (numbuf, p, adblfloat);
+  else
+    sprintf (numbuf, p, afloat);
+  p = numbuf;
+  n = strlen (numbuf);
+  pend = p + n;
+
+  if (*p =='-')
+    {
+      signchar = '-';
+      p++;
+      n--;
+    }
+  else if ((arg->flags & FLAG_PLUS_SIGN))
+    signchar = '+';
+  else if ((arg->flags & FLAG_SPACE_PLUS))
+    signchar = ' ';
+
+  n_extra = !!signchar;
+
+  if (!(arg->flags & FLAG_LEFT_JUST)
+      && arg->width >= 0 && arg->width - n_extra > n)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n_extra - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  if (signchar)
+    {
+      rc = outfnc (outfncarg, &signchar, 1);
+      if (rc)
+        return rc;
+      *nbytes += 1;
+    }
+
+  rc = outfnc (outfncarg, p, pend - p);
+  if (rc)
+    return rc;
+  *nbytes += pend - p;
+
+  if ((arg->flags & FLAG_LEFT_JUST)
+      && arg->width >= 0 && arg->width - n_extra > n)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n_extra - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  return 0;
+}
+
+
+/* "c" formatting.  */
+static int
+pr_char (estream_printf_out_t outfnc, void *outfncarg,
+            argspec_t arg, value_t value, size_t *nbytes)
+{
+  int rc;
+  char buf[1];
+
+  if (arg->vt != VALTYPE_INT)
+    return -1;
+  buf[0] = (unsigned int)value.a_int;
+
+  if (!(arg->flags & FLAG_LEFT_JUST) && arg->width > 1)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - 1, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  rc = outfnc (outfncarg, buf, 1);
+  if(rc)
+    return rc;
+  *nbytes += 1;
+
+  if ((arg->flags & FLAG_LEFT_JUST) && arg->width > 1)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - 1, nbytes);
+      if (rc)
+        return rc;
+    }
+  
+  return 0;
+}
+
+
+/* "s" formatting.  */
+static int
+pr_string (estream_printf_out_t outfnc, void *outfncarg,
+            argspec_t arg, value_t value, size_t *nbytes)
+{
+  int rc;
+  size_t n;
+  const char *string, *s;
+
+  if (arg->vt != VALTYPE_STRING)
+    return -1;
+  string = value.a_string;
+  if (!string)
+    string = "(null)";
+  if (arg->precision >= 0)
+    {
+      for (n=0,s=string; *s && n < arg->precision; s++) 
+        n++;
+    }
+  else
+    n = strlen (string);
+
+  if (!(arg->flags & FLAG_LEFT_JUST)
+      && arg->width >= 0 && arg->width > n )
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  rc = outfnc (outfncarg, string, n);
+  if (rc)
+    return rc;
+  *nbytes += n;
+
+  if ((arg->flags & FLAG_LEFT_JUST)
+      && arg->width >= 0 && arg->width > n)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n, nbytes);
+      if (rc)
+        return rc;
+    }
+  
+  return 0;
+}
+
+
+/* "p" formatting.  */
+static int
+pr_pointer (estream_printf_out_t outfnc, void *outfncarg,
+            argspec_t arg, value_t value, size_t *nbytes)
+{
+  int rc;
+  char numbuf[100];
+  int n;
+
+  if (arg->vt != VALTYPE_POINTER)
+    return -1;
+  /* The representation of a pointer is implementation defined (and
+     so is that of a null pointer); take the one of the C library so
+     that we print what its printf prints.  */
+  n = snprintf (numbuf, sizeof numbuf, "%p", value.a_void_ptr);
+  if (n < 0 || n >= sizeof numbuf)
+    return -1;
+
+  if (!(arg->flags & FLAG_LEFT_JUST) && arg->width > n)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  rc = outfnc (outfncarg, numbuf, n);
+  if (rc)
+    return rc;
+  *nbytes += n;
+
+  if ((arg->flags & FLAG_LEFT_JUST) && arg->width > n)
+    {
+      rc = pad_out (outfnc, outfncarg, ' ', arg->width - n, nbytes);
+      if (rc)
+        return rc;
+    }
+
+  return 0;
+}
+
+/* "n" pesudo format operation.  */
+static int
+pr_bytes_so_far (estream_printf_out_t outfnc, void *outfncarg,
+                 argspec_t arg, value_t value, size_t *nbytes)
+{
+  (void)outfnc;
+  (void)outfncarg;
+
+  switch (arg->vt)
     {
     case VALTYPE_SCHAR_PTR: 
       *value.a_schar_ptr = (signed char)(unsigned int)(*nbytes); 
@@ -1169,6 +2324,21 @@ pr_bytes_so_far (estream_printf_out_t outfnc, void *outfncarg,
 
 
 
+/* Return the message for ERRNUM like strerror does, but stored in
+   BUF of SIZE bytes instead of a buffer shared with other threads.  */
+static const char *
+my_strerror (int errnum, char *buf, size_t size)
+{
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+  return strerror_r (errnum, buf, size);
+#else
+  if (strerror_r (errnum, buf, size))
+    return "Unknown error";
+  return buf;
+#endif
+}
+
+
 /* Run the actual formatting.  OUTFNC and OUTFNCARG are the output
    functions.  FORMAT is format string ARGSPECS is the parsed format
    string, ARGSPECS_LEN the number of items in ARGSPECS.  VALUETABLE
@@ -1179,14 +2349,18 @@ pr_bytes_so_far (estream_printf_out_t outfnc, void *outfncarg,
 static int 
 do_format (estream_printf_out_t outfnc, void *outfncarg,
            const char *format, argspec_t argspecs, size_t argspecs_len,
-           valueitem_t valuetable, int myerrno, size_t *nbytes)
+           const struct valueitem_s *valuetable, int myerrno,
+           size_t *nbytes)
 {
   int rc = 0;
   const char *s;
   argspec_t arg = argspecs;
+  struct argspec_s argbuf;
   int argidx = 0; /* Only used for assertion.  */
   size_t n;
   value_t value;
+  char errbuf[256]; /* For "%m".  */
+  char radix = 0;   /* The decimal point; looked up on first use.  */
 
   s = format;
   while ( *s )
@@ -1224,6 +2398,11 @@ do_format (estream_printf_out_t outfnc, void *outfncarg,
       assert (argidx < argspecs_len);
       argidx++;
 
+      /* Work on a copy so that ARGSPECS may be reused, as done for
+         compiled formats.  */
+      argbuf = *arg;
+      arg = &argbuf;
+
       /* Apply indirect field width and precision values.  */
       if (arg->width == STAR_FIELD_VALUE)
         {
@@ -1244,7 +2423,7 @@ do_format (estream_printf_out_t outfnc, void *outfncarg,
         }
 
       if (arg->arg_pos == -1 && arg->conspec == CONSPEC_STRERROR)
-        value.a_string = strerror (myerrno);
+        value.a_string = my_strerror (myerrno, errbuf, sizeof errbuf);
       else
         {
           assert (arg->vt == valuetable[arg->arg_pos-1].vt);
@@ -1270,7 +2449,13 @@ do_format (estream_printf_out_t outfnc, void *outfncarg,
         case CONSPEC_F_OR_G_UP:
         case CONSPEC_HEX_EXP:
         case CONSPEC_HEX_EXP_UP:
-          rc = pr_float (outfnc, outfncarg, arg, value, nbytes);
+          if (!radix)
+            {
+              radix = *nl_langinfo (RADIXCHAR);
+              if (!radix)
+                radix = '.';
+            }
+          rc = pr_float (outfnc, outfncarg, arg, value, radix, nbytes);
           break;
         case CONSPEC_CHAR:
           rc = pr_char (outfnc, outfncarg, arg, value, nbytes);
@@ -1288,7 +2473,7 @@ do_format (estream_printf_out_t outfnc, void *outfncarg,
         }
       if (rc)
         return rc;
-      arg++;    
+      arg = argspecs + argidx;
     }
   
   /* Print out any trailing stuff. */
@@ -1302,42 +2487,103 @@ do_format (estream_printf_out_t outfnc, void *outfncarg,
 
 
 
-/* The versatile printf formatting routine.  It expects a callback
-   function OUTFNC and an opaque argument OUTFNCARG used for actual
-   output of the formatted stuff.  FORMAT is the format specification
-   and VAARGS a variable argumemt list matching the arguments of
-   FORMAT.  */
-int 
-estream_format (estream_printf_out_t outfnc,
-                void *outfncarg,
-                const char *format, va_list vaargs)
+/* Size of the stack buffer used by do_format_staged.  */
+#define STAGING_BUFFER_SIZE 512
+
+/* State for staging_out.  */
+struct staging_parm_s
 {
-  /* Buffer to hold the argspecs and a pointer to it.*/
-  struct argspec_s argspecs_buffer[DEFAULT_MAX_ARGSPECS];
-  argspec_t argspecs = argspecs_buffer;
-  size_t argspecs_len;  /* Number of specifications in ARGSPECS.  */
+  estream_printf_out_t outfnc;  /* The actual output function.  */
+  void *outfncarg;              /* And its argument.  */
+  size_t used;                  /* Used length of BUFFER.  */
+  char buffer[STAGING_BUFFER_SIZE];
+};
 
-  /* Buffer to hold the description for the values.  */
-  struct valueitem_s valuetable_buffer[DEFAULT_MAX_VALUES];
-  valueitem_t valuetable = valuetable_buffer;
 
-  int rc;     /* Return code. */
-  size_t argidx; /* Used to index the argspecs array.  */
-  size_t validx; /* Used to index the valuetable.  */
-  int max_pos;/* Highest argument position.  */
+/* Output function collecting the small pieces produced by do_format
+   so that the real output function is called only once per full
+   buffer.  Pieces which do not fit into the buffer are passed on
+   directly.  */
+static int
+staging_out (void *outfncarg, const char *buf, size_t buflen)
+{
+  struct staging_parm_s *parm = outfncarg;
+  int rc;
 
-  size_t nbytes = 0; /* Keep track of the number of bytes passed to
-                        the output function.  */
+  if (buflen > sizeof parm->buffer - parm->used)
+    {
+      if (parm->used)
+        {
+          rc = parm->outfnc (parm->outfncarg, parm->buffer, parm->used);
+          parm->used = 0;
+          if (rc)
+            return rc;
+        }
+      if (buflen >= sizeof parm->buffer)
+        return parm->outfnc (parm->outfncarg, buf, buflen);
+    }
+  memcpy (parm->buffer + parm->used, buf, buflen);
+  parm->used += buflen;
+  return 0;
+}
 
-  int myerrno = errno; /* Save the errno for use with "%m". */
 
+static int fixed_buffer_out (void *outfncarg, const char *buf, size_t buflen);
+static int dynamic_buffer_out (void *outfncarg, const char *buf,
+                               size_t buflen);
+
+/* Same as do_format but collect the output in a stack buffer and
+   pass it to OUTFNC in as few calls as possible.  Our own memory
+   buffer output functions are called directly because they are not
+   more expensive than the staging itself.  */
+static int
+do_format_staged (estream_printf_out_t outfnc, void *outfncarg,
+                  const char *format, argspec_t argspecs, size_t argspecs_len,
+                  const struct valueitem_s *valuetable, int myerrno,
+                  size_t *nbytes)
+{
+  struct staging_parm_s parm;
+  int rc;
+
+  if (outfnc == fixed_buffer_out || outfnc == dynamic_buffer_out)
+    return do_format (outfnc, outfncarg, format, argspecs, argspecs_len,
+                      valuetable, myerrno, nbytes);
+
+  parm.outfnc = outfnc;
+  parm.outfncarg = outfncarg;
+  parm.used = 0;
+  rc = do_format (staging_out, &parm, format, argspecs, argspecs_len,
+                  valuetable, myerrno, nbytes);
+  if (!rc && parm.used)
+    rc = outfnc (outfncarg, parm.buffer, parm.used);
+  return rc;
+}
+
+
+/* Parse FORMAT into the specification array stored at ARGSPECS_ADDR
+   as done by parse_format and assign the argument positions.  The
+   highest argument position is stored at R_MAX_POS.  On error -1 is
+   returned with ERRNO set and NULL stored at ARGSPECS_ADDR if the
+   array had to be allocated.  */
+static int
+compile_format (const char *format,
+                argspec_t *argspecs_addr, size_t max_argspecs,
+                size_t *r_argspecs_len, int *r_max_pos)
+{
+  argspec_t argspecs;
+  size_t argspecs_len;  /* Number of specifications in ARGSPECS.  */
+  size_t argidx; /* Used to index the argspecs array.  */
+  int max_pos;/* Highest argument position.  */
+  argspec_t argspecs_orig = *argspecs_addr;
+  int rc;
 
   /* Parse the arguments to come up with descriptive list.  We can't
      do this on the fly because we need to support positional
      arguments. */
-  rc = parse_format (format, &argspecs, DIM(argspecs_buffer), &argspecs_len);
+  rc = parse_format (format, argspecs_addr, max_argspecs, &argspecs_len);
   if (rc)
-    goto leave;
+    return rc;
+  argspecs = *argspecs_addr;
 
   /* Check that all ARG_POS fields are set.  */
   for (argidx=0,max_pos=0; argidx < argspecs_len; argidx++)
@@ -1378,51 +2624,123 @@ estream_format (estream_printf_out_t outfnc,
     }
   /* Check that there is no overflow in max_pos and that it has a
      reasonable length.  There may never be more elements than the
-     number of characters in FORMAT.  */
-  if (max_pos < 0 || max_pos >= strlen (format))
+     number of characters in FORMAT.  An empty FORMAT is fine.  */
+  if (max_pos < 0 || (max_pos && max_pos >= strlen (format)))
     goto leave_einval;
 
 #ifdef DEBUG
     dump_argspecs (argspecs, argspecs_len);
 #endif
 
-  /* Allocate a table to hold the values.  If it is small enough we
-     use a stack allocated buffer.  */
-  if (max_pos > DIM(valuetable_buffer))
-    {
-      valuetable = calloc (max_pos, sizeof *valuetable);
-      if (!valuetable)
-        goto leave_error;
-    }
-  else
-    {
-      for (validx=0; validx < DIM(valuetable_buffer); validx++)
-        valuetable[validx].vt = VALTYPE_UNSUPPORTED;
-    }
+  *r_argspecs_len = argspecs_len;
+  *r_max_pos = max_pos;
+  return 0;
+
+ leave_einval:
+  if (argspecs != argspecs_orig)
+    free (argspecs);
+  *argspecs_addr = NULL;
+  errno = EINVAL;
+  return -1;
+}
+
+
+/* Set the types of the MAX_POS items of VALUETABLE as described by
+   the ARGSPECS_LEN items of ARGSPECS.  VALUETABLE must have been
+   cleared.  Returns -1 if a position is used twice.  */
+static int
+setup_valuetable (argspec_t argspecs, size_t argspecs_len,
+                  valueitem_t valuetable)
+{
+  size_t argidx;
+  size_t validx;
+
   for (argidx=0; argidx < argspecs_len; argidx++)
     {
       if (argspecs[argidx].arg_pos != - 1)
         {
           validx = argspecs[argidx].arg_pos - 1;
           if (valuetable[validx].vt)
-            goto leave_einval; /* Already defined. */
+            return -1; /* Already defined. */
           valuetable[validx].vt = argspecs[argidx].vt;
         }
       if (argspecs[argidx].width == STAR_FIELD_VALUE)
         {
           validx = argspecs[argidx].width_pos - 1;
           if (valuetable[validx].vt)
-            goto leave_einval; /* Already defined.  */
+            return -1; /* Already defined.  */
           valuetable[validx].vt = VALTYPE_INT;
         }
       if (argspecs[argidx].precision == STAR_FIELD_VALUE)
         {
           validx = argspecs[argidx].precision_pos - 1;
           if (valuetable[validx].vt)
-            goto leave_einval; /* Already defined.  */
+            return -1; /* Already defined.  */
           valuetable[validx].vt = VALTYPE_INT;
         }
     }
+  return 0;
+}
+
+
+/* Common part of estream_format and estream_format_noalloc.  The
+   caller provides MAX_ARGSPECS argspecs at ARGSPECS_BUFFER and
+   MAX_VALUES values at VALUETABLE_BUFFER; larger tables are allocated
+   unless NOALLOC is set, in which case such a FORMAT fails with
+   EINVAL.  */
+static int
+format_buffered (estream_printf_out_t outfnc, void *outfncarg,
+                 const char *format, va_list vaargs,
+                 argspec_t argspecs_buffer, size_t max_argspecs,
+                 valueitem_t valuetable_buffer, size_t max_values,
+                 int noalloc)
+{
+  argspec_t argspecs = argspecs_buffer;
+  size_t argspecs_len;  /* Number of specifications in ARGSPECS.  */
+  valueitem_t valuetable = valuetable_buffer;
+
+  int rc;     /* Return code. */
+  size_t validx; /* Used to index the valuetable.  */
+  int max_pos;/* Highest argument position.  */
+  const char *s;
+
+  size_t nbytes = 0; /* Keep track of the number of bytes passed to
+                        the output function.  */
+
+  int myerrno = errno; /* Save the errno for use with "%m". */
+
+
+  /* Each specification starts with a percent sign; with no more of
+     them than there are slots parse_format will not allocate.  */
+  if (noalloc && format)
+    {
+      for (validx=0, s=format; (s = strchr (s, '%')); s++)
+        if (++validx > max_argspecs)
+          goto leave_einval;
+    }
+
+  rc = compile_format (format, &argspecs, max_argspecs,
+                       &argspecs_len, &max_pos);
+  if (rc)
+    goto leave;
+
+  /* Allocate a table to hold the values.  If it is small enough we
+     use the caller's buffer.  */
+  if (max_pos > max_values)
+    {
+      if (noalloc)
+        goto leave_einval;
+      valuetable = calloc (max_pos, sizeof *valuetable);
+      if (!valuetable)
+        goto leave_error;
+    }
+  else
+    {
+      for (validx=0; validx < max_values; validx++)
+        valuetable[validx].vt = VALTYPE_UNSUPPORTED;
+    }
+  if (setup_valuetable (argspecs, argspecs_len, valuetable))
+    goto leave_einval;
   
   /* Read all the arguments.  This will error out for unsupported
      types and for not given positional arguments. */
@@ -1434,8 +2752,8 @@ estream_format (estream_printf_out_t outfnc,
 /*     fprintf (stderr, "%2d: vt=%d\n", validx, valuetable[validx].vt); */
 
   /* Everything has been collected, go ahead with the formatting.  */
-  rc = do_format (outfnc, outfncarg, format,
-                  argspecs, argspecs_len, valuetable, myerrno, &nbytes);
+  rc = do_format_staged (outfnc, outfncarg, format,
+                         argspecs, argspecs_len, valuetable, myerrno, &nbytes);
 
   goto leave;
   
@@ -1446,13 +2764,187 @@ estream_format (estream_printf_out_t outfnc,
  leave:
   if (valuetable != valuetable_buffer)
     free (valuetable);
-  if (argspecs != argspecs_buffer)
-    free (argspecs);
+  if (argspecs && argspecs != argspecs_buffer)
+    free (argspecs);
+  return rc;
+}
+
+
+/* The versatile printf formatting routine.  It expects a callback
+   function OUTFNC and an opaque argument OUTFNCARG used for actual
+   output of the formatted stuff.  FORMAT is the format specification
+   and VAARGS a variable argumemt list matching the arguments of
+   FORMAT.  */
+int 
+estream_format (estream_printf_out_t outfnc,
+                void *outfncarg,
+                const char *format, va_list vaargs)
+{
+  struct argspec_s argspecs_buffer[DEFAULT_MAX_ARGSPECS];
+  struct valueitem_s valuetable_buffer[DEFAULT_MAX_VALUES];
+
+  return format_buffered (outfnc, outfncarg, format, vaargs,
+                          argspecs_buffer, DIM(argspecs_buffer),
+                          valuetable_buffer, DIM(valuetable_buffer), 0);
+}
+
+
+/* Same as estream_format but without allocating memory: a FORMAT with
+   more than NOALLOC_MAX_ARGSPECS percent signs or more than
+   NOALLOC_MAX_VALUES arguments fails with EINVAL.  */
+int 
+estream_format_noalloc (estream_printf_out_t outfnc,
+                        void *outfncarg,
+                        const char *format, va_list vaargs)
+{
+  struct argspec_s argspecs_buffer[NOALLOC_MAX_ARGSPECS];
+  struct valueitem_s valuetable_buffer[NOALLOC_MAX_VALUES];
+
+  return format_buffered (outfnc, outfncarg, format, vaargs,
+                          argspecs_buffer, DIM(argspecs_buffer),
+                          valuetable_buffer, DIM(valuetable_buffer), 1);
+}
+
+
+
+/* A format string which has been parsed in advance by
+   estream_format_compile.  The object is not modified by
+   estream_format_exec and may thus be shared between threads.  */
+struct estream_format_s
+{
+  char *format;              /* Copy of the format string.  */
+  argspec_t argspecs;        /* The parsed specifications.  */
+  size_t argspecs_len;       /* Number of items in ARGSPECS.  */
+  int max_pos;               /* Number of values expected.  */
+  valueitem_t valuetypes;    /* MAX_POS values with only VT set.  */
+};
+
+
+/* Parse FORMAT once for use with estream_format_exec.  Returns NULL
+   and sets ERRNO if FORMAT is invalid or on memory shortage.  */
+estream_format_t
+estream_format_compile (const char *format)
+{
+  estream_format_t fmt;
+  size_t n;
+
+  fmt = calloc (1, sizeof *fmt);
+  if (!fmt)
+    return NULL;
+  if (!format)
+    {
+      errno = EINVAL;
+      goto leave;
+    }
+  n = strlen (format);
+  fmt->format = my_printf_malloc (n + 1);
+  if (!fmt->format)
+    goto leave;
+  memcpy (fmt->format, format, n + 1);
+
+  /* Always let parse_format allocate the array.  */
+  fmt->argspecs = NULL;
+  if (compile_format (fmt->format, &fmt->argspecs, 0,
+                      &fmt->argspecs_len, &fmt->max_pos))
+    goto leave;
+
+  fmt->valuetypes = calloc (fmt->max_pos? fmt->max_pos : 1,
+                            sizeof *fmt->valuetypes);
+  if (!fmt->valuetypes)
+    goto leave;
+  if (setup_valuetable (fmt->argspecs, fmt->argspecs_len, fmt->valuetypes))
+    {
+      errno = EINVAL;
+      goto leave;
+    }
+
+  return fmt;
+
+ leave:
+  estream_format_release (fmt);
+  return NULL;
+}
+
+
+/* Release a format compiled by estream_format_compile.  */
+void
+estream_format_release (estream_format_t fmt)
+{
+  if (fmt)
+    {
+      free (fmt->valuetypes);
+      free (fmt->argspecs);
+      my_printf_free (fmt->format);
+      free (fmt);
+    }
+}
+
+
+/* Same as estream_format but using the compiled format FMT.  */
+int
+estream_format_exec (estream_printf_out_t outfnc, void *outfncarg,
+                     estream_format_t fmt, va_list vaargs)
+{
+  struct valueitem_s valuetable_buffer[DEFAULT_MAX_VALUES];
+  valueitem_t valuetable = valuetable_buffer;
+  size_t nbytes = 0;
+  int myerrno = errno; /* Save the errno for use with "%m". */
+  int rc;
+
+  if (fmt->max_pos > DIM(valuetable_buffer))
+    {
+      valuetable = malloc (fmt->max_pos * sizeof *valuetable);
+      if (!valuetable)
+        return -1;
+    }
+  memcpy (valuetable, fmt->valuetypes, fmt->max_pos * sizeof *valuetable);
+
+  rc = read_values (valuetable, fmt->max_pos, vaargs);
+  if (rc)
+    errno = EINVAL;
+  else
+    rc = do_format_staged (outfnc, outfncarg, fmt->format,
+                           fmt->argspecs, fmt->argspecs_len,
+                           valuetable, myerrno, &nbytes);
+
+  if (valuetable != valuetable_buffer)
+    free (valuetable);
   return rc;
 }
 
 
 
+/* Same as estream_format_exec but take the values from the array
+   VALUES with NVALUES items instead of a variable argument list.
+   VALUES[N] is used for the argument at position N+1 and its type
+   must be the one expected by FMT.  */
+int
+estream_format_values (estream_printf_out_t outfnc, void *outfncarg,
+                       estream_format_t fmt,
+                       const struct valueitem_s *values, size_t nvalues)
+{
+  size_t nbytes = 0;
+  int myerrno = errno; /* Save the errno for use with "%m". */
+  int validx;
+
+  if (nvalues < fmt->max_pos)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  for (validx=0; validx < fmt->max_pos; validx++)
+    if (values[validx].vt != fmt->valuetypes[validx].vt)
+      {
+        errno = EINVAL;
+        return -1;
+      }
+
+  return do_format_staged (outfnc, outfncarg, fmt->format,
+                           fmt->argspecs, fmt->argspecs_len,
+                           values, myerrno, &nbytes);
+}
+
+
 
 /* A simple output handler utilizing stdio.  */
 static int
@@ -1566,6 +3058,67 @@ estream_vsnprintf (char *buf, size_t bufsize,
                              been written.  */
 }
 
+
+/* Print VALUE to BUF of BUFSIZE bytes like snprintf does for the
+   conversion CONV, which is one of "e,E,f,F,g,G" without flags, field
+   width or precision, but with the shortest string of digits which
+   reads back to the same double.  For 'g' the plain notation is used
+   up to an exponent of 5 or the number of digits if that is larger.
+   The decimal point is always a '.'.  This is not available as a
+   printf flag so that the compiler can still check the formats.  */
+int
+estream_snprintf_shortest (char *buf, size_t bufsize, int conv, double value)
+{
+#ifdef ESTREAM_NATIVE_DOUBLE
+  struct fixed_buffer_parm_s parm;
+  struct argspec_s arg;
+  value_t v;
+  size_t nbytes = 0;
+  int rc;
+
+  memset (&arg, 0, sizeof arg);
+  switch (conv)
+    {
+    case 'e': arg.conspec = CONSPEC_EXP; break;
+    case 'E': arg.conspec = CONSPEC_EXP_UP; break;
+    case 'f': arg.conspec = CONSPEC_FLOAT; break;
+    case 'F': arg.conspec = CONSPEC_FLOAT_UP; break;
+    case 'g': arg.conspec = CONSPEC_F_OR_G; break;
+    case 'G': arg.conspec = CONSPEC_F_OR_G_UP; break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+  arg.flags = FLAG_SHORTEST;
+  arg.width = NO_FIELD_VALUE;
+  arg.precision = NO_FIELD_VALUE;
+  arg.vt = VALTYPE_DOUBLE;
+  v.a_double = value;
+
+  parm.size = bufsize;
+  parm.count = 0;
+  parm.used = 0;
+  parm.buffer = bufsize?buf:NULL;
+  rc = pr_float (fixed_buffer_out, &parm, &arg, v, '.', &nbytes);
+  if (!rc)
+    rc = fixed_buffer_out (&parm, "", 1); /* Print terminating Nul.  */
+  if (rc == -1)
+    return -1;
+  if (bufsize && buf && parm.size && parm.count >= parm.size)
+    buf[parm.size-1] = 0;
+
+  parm.count--; /* Do not count the trailing nul.  */
+  return (int)parm.count;
+#else
+  (void)buf;
+  (void)bufsize;
+  (void)conv;
+  (void)value;
+  errno = ENOSYS;  /* Doubles are not in IEEE binary64 format.  */
+  return -1;
+#endif
+}
+
 /* A replacement for snprintf.  */
 int 
 estream_snprintf (char *buf, size_t bufsize, const char *format, ...)
@@ -1583,9 +3136,13 @@ estream_snprintf (char *buf, size_t bufsize, const char *format, ...)
 
 /* Communication object used between estream_asprintf and
    dynamic_buffer_out.  */
+/* Size of the stack buffer estream_vasprintf starts with.  */
+#define DYNAMIC_BUFFER_INITIAL_SIZE 256
+
 struct dynamic_buffer_parm_s
 {
   int error_flag; /* Internal helper.  */ 
+  int on_stack;   /* BUFFER is the caller's stack buffer.  */
   size_t alloced; /* Allocated size of the buffer.  */
   size_t used;    /* Used size of the buffer.  */
   char *buffer;   /* Malloced buffer.  */
@@ -1608,9 +3165,24 @@ dynamic_buffer_out (void *outfncarg, const char *buf, size_t buflen)
   if (parm->used + buflen >= parm->alloced)
     {
       char *p;
-      
-      parm->alloced += buflen + 512;
-      p = realloc (parm->buffer, parm->alloced);
+      size_t newsize;
+
+      /* Grow geometrically so that long outputs are not copied over
+         and over.  */
+      newsize = parm->alloced * 2;
+      if (newsize < parm->used + buflen + 1)
+        newsize = parm->used + buflen + 1;
+      if (parm->on_stack)
+        {
+          p = my_printf_malloc (newsize);
+          if (p)
+            {
+              memcpy (p, parm->buffer, parm->used);
+              memset (parm->buffer, 0, parm->used);
+            }
+        }
+      else
+        p = realloc (parm->buffer, newsize);
       if (!p)
         {
           parm->error_flag = errno ? errno : ENOMEM;
@@ -1620,6 +3192,8 @@ dynamic_buffer_out (void *outfncarg, const char *buf, size_t buflen)
           return -1;
         }
       parm->buffer = p;
+      parm->alloced = newsize;
+      parm->on_stack = 0;
     }
   memcpy (parm->buffer + parm->used, buf, buflen);
   parm->used += buflen;
@@ -1630,22 +3204,21 @@ dynamic_buffer_out (void *outfncarg, const char *buf, size_t buflen)
 
 /* A replacement for vasprintf.  As with the BSD of vasprintf version -1
    will be returned on error and NULL stored at BUFP.  On success the
-   number of bytes printed will be returned. */
+   number of bytes printed will be returned.  The output is first
+   collected in a stack buffer so that short strings need only one
+   exactly sized allocation.  */
 int 
 estream_vasprintf (char **bufp, const char *format, va_list arg_ptr)
 {
   struct dynamic_buffer_parm_s parm;
+  char stackbuf[DYNAMIC_BUFFER_INITIAL_SIZE];
   int rc;
 
   parm.error_flag = 0;
-  parm.alloced = 512;
+  parm.on_stack = 1;
+  parm.alloced = sizeof stackbuf;
   parm.used = 0;
-  parm.buffer = my_printf_malloc (parm.alloced);
-  if (!parm.buffer)
-    {
-      *bufp = NULL;
-      return -1;
-    }
+  parm.buffer = stackbuf;
   
   rc = estream_format (dynamic_buffer_out, &parm, format, arg_ptr);
   if (!rc)
@@ -1656,10 +3229,25 @@ estream_vasprintf (char **bufp, const char *format, va_list arg_ptr)
       rc = -1;
       errno = parm.error_flag;
     }
+  if (rc != -1 && parm.on_stack)
+    {
+      char *p = my_printf_malloc (parm.used);
+
+      if (!p)
+        rc = -1;
+      else
+        {
+          memcpy (p, stackbuf, parm.used);
+          memset (stackbuf, 0, parm.used);
+          parm.buffer = p;
+          parm.on_stack = 0;
+        }
+    }
   if (rc == -1)
     {
       memset (parm.buffer, 0, parm.used);
-      my_printf_free (parm.buffer);
+      if (!parm.on_stack)
+        my_printf_free (parm.buffer);
       *bufp = NULL;
       return -1;
     }
@@ -1683,3 +3271,449 @@ estream_asprintf (char **bufp, const char *format, ...)
     
   return rc;
 }
+
+
+
+/* An async-signal-safe subset of the formatting for use in signal
+   handlers and in children after fork.  It does not allocate memory,
+   take locks or call stdio.  Only the flags "-0+ #", field width and
+   precision (also as '*'), the length modifiers "hh,h,l,ll,z,j,t" and
+   the conversions "d,i,u,o,x,X,c,s,p,m,%" are supported; positional
+   arguments are not.  As strerror is not async-signal-safe "%m"
+   prints the number of the error.  An unsupported conversion stops
+   the formatting with EINVAL.  */
+
+/* State for the safe formatter.  */
+struct safe_parm_s
+{
+  int fd;          /* File descriptor to write to or -1.  */
+  char *buffer;    /* The output buffer.  */
+  size_t size;     /* Usable size of BUFFER.  */
+  size_t used;     /* Bytes stored in BUFFER.  */
+  size_t total;    /* Bytes produced so far.  */
+  int error;       /* Set after a write error.  */
+};
+
+
+/* Write out the buffered data of PARM.  */
+static int
+safe_flush (struct safe_parm_s *parm)
+{
+  const char *p = parm->buffer;
+  size_t n = parm->used;
+  ssize_t nwritten;
+
+  while (n)
+    {
+      nwritten = write (parm->fd, p, n);
+      if (nwritten == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          parm->error = errno;
+          return -1;
+        }
+      p += nwritten;
+      n -= nwritten;
+    }
+  parm->used = 0;
+  return 0;
+}
+
+
+/* Output N bytes from S.  For buffer output everything which does not
+   fit is dropped.  */
+static void
+safe_put (struct safe_parm_s *parm, const char *s, size_t n)
+{
+  size_t k;
+
+  parm->total += n;
+  while (n && !parm->error)
+    {
+      if (parm->used == parm->size)
+        {
+          if (parm->fd == -1 || safe_flush (parm))
+            return;
+        }
+      k = parm->size - parm->used;
+      if (k > n)
+        k = n;
+      memcpy (parm->buffer + parm->used, s, k);
+      parm->used += k;
+      s += k;
+      n -= k;
+    }
+}
+
+
+static void
+safe_pad (struct safe_parm_s *parm, int padchar, int count)
+{
+  char buf[16];
+
+  memset (buf, padchar, sizeof buf);
+  for (; count > 0; count -= sizeof buf)
+    safe_put (parm, buf, count < sizeof buf? count : sizeof buf);
+}
+
+
+/* Print VALUE in BASE with the sign SIGNCHAR (or 0) and PREFIX (or
+   NULL) according to FLAGS, WIDTH and PRECISION.  */
+static void
+safe_integer (struct safe_parm_s *parm, unsigned int flags,
+              int width, int precision, unsigned long long value,
+              char signchar, const char *prefix, int base, int upper)
+{
+  char numbuf[24];
+  const char *digits = upper? "0123456789ABCDEF" : "0123456789abcdef";
+  char *p, *pend;
+  int n, n_extra, n_prec;
+
+  p = pend = numbuf + sizeof numbuf;
+  if (!value && !precision)
+    ;
+  else if (base == 10)
+    {
+      n = count_digits (value);
+      p -= n;
+      put_decimal (p, n, value);
+    }
+  else
+    {
+      do
+        {
+          *--p = digits[value % base];
+          value /= base;
+        }
+      while (value);
+    }
+  if (base == 8 && (flags & FLAG_ALT_CONV) && (p == pend || *p != '0'))
+    *--p = '0';
+  n = pend - p;
+  n_extra = !!signchar + (prefix? strlen (prefix) : 0);
+
+  if ((flags & FLAG_ZERO_PAD) && precision == NO_FIELD_VALUE
+      && !(flags & FLAG_LEFT_JUST) && width - n_extra > n)
+    n_prec = width - n_extra - n;
+  else if (precision > n)
+    n_prec = precision - n;
+  else
+    n_prec = 0;
+
+  if (!(flags & FLAG_LEFT_JUST))
+    safe_pad (parm, ' ', width - n_extra - n - n_prec);
+  if (signchar)
+    safe_put (parm, &signchar, 1);
+  if (prefix)
+    safe_put (parm, prefix, strlen (prefix));
+  safe_pad (parm, '0', n_prec);
+  safe_put (parm, p, n);
+  if ((flags & FLAG_LEFT_JUST))
+    safe_pad (parm, ' ', width - n_extra - n - n_prec);
+}
+
+
+static int
+safe_format (struct safe_parm_s *parm, const char *format, va_list ap,
+             int myerrno)
+{
+  const char *s, *t;
+  unsigned int flags;
+  int width, precision, lenmod, base, upper;
+  unsigned long long uvalue;
+  long long svalue;
+  char signchar;
+  const char *prefix;
+  const char *string;
+  char c;
+  size_t n;
+
+  for (s = format; *s; )
+    {
+      if (*s != '%')
+        {
+          for (t = s; *t && *t != '%'; t++)
+            ;
+          safe_put (parm, s, t - s);
+          s = t;
+          continue;
+        }
+      s++;
+      if (*s == '%')
+        {
+          safe_put (parm, s, 1);
+          s++;
+          continue;
+        }
+
+      for (flags = 0; ; s++)
+        {
+          if (*s == '-')
+            flags |= FLAG_LEFT_JUST;
+          else if (*s == '+')
+            flags |= FLAG_PLUS_SIGN;
+          else if (*s == ' ')
+            flags |= FLAG_SPACE_PLUS;
+          else if (*s == '#')
+            flags |= FLAG_ALT_CONV;
+          else if (*s == '0')
+            flags |= FLAG_ZERO_PAD;
+          else
+            break;
+        }
+
+      width = 0;
+      if (*s == '*')
+        {
+          width = va_arg (ap, int);
+          if (width < 0)
+            {
+              width = -width;
+              flags |= FLAG_LEFT_JUST;
+            }
+          s++;
+        }
+      else
+        for (; *s >= '0' && *s <= '9'; s++)
+          width = width * 10 + (*s - '0');
+
+      precision = NO_FIELD_VALUE;
+      if (*s == '.')
+        {
+          s++;
+          if (*s == '*')
+            {
+              precision = va_arg (ap, int);
+              if (precision < 0)
+                precision = NO_FIELD_VALUE;
+              s++;
+            }
+          else
+            for (precision = 0; *s >= '0' && *s <= '9'; s++)
+              precision = precision * 10 + (*s - '0');
+        }
+
+      lenmod = LENMOD_NONE;
+      switch (*s)
+        {
+        case 'h':
+          s++;
+          if (*s == 'h')
+            {
+              s++;
+              lenmod = LENMOD_CHAR;
+            }
+          else
+            lenmod = LENMOD_SHORT;
+          break;
+        case 'l':
+          s++;
+          if (*s == 'l')
+            {
+              s++;
+              lenmod = LENMOD_LONGLONG;
+            }
+          else
+            lenmod = LENMOD_LONG;
+          break;
+        case 'j': s++; lenmod = LENMOD_INTMAX; break;
+        case 'z': s++; lenmod = LENMOD_SIZET; break;
+        case 't': s++; lenmod = LENMOD_PTRDIFF; break;
+        }
+
+      signchar = 0;
+      prefix = NULL;
+      base = 10;
+      upper = 0;
+      switch (*s)
+        {
+        case 'd':
+        case 'i':
+          switch (lenmod)
+            {
+            case LENMOD_CHAR: svalue = (signed char)va_arg (ap, int); break;
+            case LENMOD_SHORT: svalue = (short)va_arg (ap, int); break;
+            case LENMOD_LONG: svalue = va_arg (ap, long); break;
+            case LENMOD_LONGLONG: svalue = va_arg (ap, long long); break;
+            case LENMOD_INTMAX: svalue = va_arg (ap, intmax_t); break;
+            case LENMOD_SIZET: svalue = va_arg (ap, ssize_t); break;
+            case LENMOD_PTRDIFF: svalue = va_arg (ap, ptrdiff_t); break;
+            default: svalue = va_arg (ap, int); break;
+            }
+          if (svalue < 0)
+            {
+              uvalue = -(unsigned long long)svalue;
+              signchar = '-';
+            }
+          else
+            {
+              uvalue = svalue;
+              if ((flags & FLAG_PLUS_SIGN))
+                signchar = '+';
+              else if ((flags & FLAG_SPACE_PLUS))
+                signchar = ' ';
+            }
+          safe_integer (parm, flags, width, precision, uvalue, signchar,
+                        NULL, 10, 0);
+          break;
+
+        case 'X':
+          upper = 1;
+          /* fall through */
+        case 'x':
+          base = 16;
+          goto unsigned_conv;
+        case 'o':
+          base = 8;
+          /* fall through */
+        case 'u':
+        unsigned_conv:
+          switch (lenmod)
+            {
+            case LENMOD_CHAR:
+              uvalue = (unsigned char)va_arg (ap, unsigned int);
+              break;
+            case LENMOD_SHORT:
+              uvalue = (unsigned short)va_arg (ap, unsigned int);
+              break;
+            case LENMOD_LONG: uvalue = va_arg (ap, unsigned long); break;
+            case LENMOD_LONGLONG:
+              uvalue = va_arg (ap, unsigned long long);
+              break;
+            case LENMOD_INTMAX: uvalue = va_arg (ap, uintmax_t); break;
+            case LENMOD_SIZET: uvalue = va_arg (ap, size_t); break;
+            case LENMOD_PTRDIFF: uvalue = va_arg (ap, ptrdiff_t); break;
+            default: uvalue = va_arg (ap, unsigned int); break;
+            }
+          if (base == 16 && (flags & FLAG_ALT_CONV) && uvalue)
+            prefix = upper? "0X" : "0x";
+          safe_integer (parm, flags, width, precision, uvalue, 0,
+                        prefix, base, upper);
+          break;
+
+        case 'p':
+          uvalue = (uintptr_t)va_arg (ap, void *);
+          safe_integer (parm, flags & ~FLAG_ZERO_PAD, width, NO_FIELD_VALUE,
+                        uvalue, 0, "0x", 16, 0);
+          break;
+
+        case 'c':
+          c = (char)va_arg (ap, int);
+          if (!(flags & FLAG_LEFT_JUST))
+            safe_pad (parm, ' ', width - 1);
+          safe_put (parm, &c, 1);
+          if ((flags & FLAG_LEFT_JUST))
+            safe_pad (parm, ' ', width - 1);
+          break;
+
+        case 's':
+          string = va_arg (ap, const char *);
+          if (!string)
+            string = "(null)";
+          for (n = 0; string[n] && (precision < 0 || n < precision); n++)
+            ;
+          if (!(flags & FLAG_LEFT_JUST))
+            safe_pad (parm, ' ', width - (int)n);
+          safe_put (parm, string, n);
+          if ((flags & FLAG_LEFT_JUST))
+            safe_pad (parm, ' ', width - (int)n);
+          break;
+
+        case 'm':
+          safe_put (parm, "error ", 6);
+          safe_integer (parm, 0, 0, NO_FIELD_VALUE,
+                        myerrno < 0? -(unsigned long long)myerrno : myerrno,
+                        myerrno < 0? '-' : 0, NULL, 10, 0);
+          break;
+
+        default:
+          errno = EINVAL;
+          return -1;
+        }
+      s++;
+    }
+  return 0;
+}
+
+
+/* Async-signal-safe version of vsnprintf; see safe_format for the
+   supported formats.  Returns the length of the full output as
+   vsnprintf does or -1 for an invalid FORMAT.  */
+int
+estream_safe_vsnprintf (char *buf, size_t bufsize,
+                        const char *format, va_list arg_ptr)
+{
+  struct safe_parm_s parm;
+  int myerrno = errno;
+
+  parm.fd = -1;
+  parm.buffer = buf;
+  parm.size = bufsize? bufsize - 1 : 0;
+  parm.used = 0;
+  parm.total = 0;
+  parm.error = 0;
+  if (safe_format (&parm, format, arg_ptr, myerrno))
+    return -1;
+  if (bufsize)
+    buf[parm.used] = 0;
+  errno = myerrno;
+  return parm.total;
+}
+
+
+int
+estream_safe_snprintf (char *buf, size_t bufsize, const char *format, ...)
+{
+  int rc;
+  va_list arg_ptr;
+
+  va_start (arg_ptr, format);
+  rc = estream_safe_vsnprintf (buf, bufsize, format, arg_ptr);
+  va_end (arg_ptr);
+
+  return rc;
+}
+
+
+/* Async-signal-safe version of vdprintf.  The output is written to
+   FD in chunks of up to 256 bytes.  ERRNO is preserved on success.  */
+int
+estream_safe_vdprintf (int fd, const char *format, va_list arg_ptr)
+{
+  struct safe_parm_s parm;
+  char buffer[256];
+  int myerrno = errno;
+
+  parm.fd = fd;
+  parm.buffer = buffer;
+  parm.size = sizeof buffer;
+  parm.used = 0;
+  parm.total = 0;
+  parm.error = 0;
+  if (safe_format (&parm, format, arg_ptr, myerrno))
+    return -1;
+  if (!parm.error && parm.used)
+    safe_flush (&parm);
+  if (parm.error)
+    {
+      errno = parm.error;
+      return -1;
+    }
+  errno = myerrno;
+  return parm.total;
+}
+
+
+int
+estream_safe_dprintf (int fd, const char *format, ...)
+{
+  int rc;
+  va_list arg_ptr;
+
+  va_start (arg_ptr, format);
+  rc = estream_safe_vdprintf (fd, format, arg_ptr);
+  va_end (arg_ptr);
+
+  return rc;
+}
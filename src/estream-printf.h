@@ -22,6 +22,9 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <estream.h>  /* For the value types.  */
 
 /* To use this file with libraries the following macro is useful:
 
@@ -56,9 +59,15 @@ extern "C"
 typedef int (*estream_printf_out_t)
      (void *outfncarg,  const char *buf, size_t buflen);
 
+/* The value types es_valtype_t, es_value_t and struct es_valueitem_s
+   are defined in estream.h.  */
+
 int estream_format (estream_printf_out_t outfnc, void *outfncarg,
                     const char *format, va_list vaargs) 
      _ESTREAM_GCC_A_PRINTF(3,0);
+int estream_format_noalloc (estream_printf_out_t outfnc, void *outfncarg,
+                            const char *format, va_list vaargs)
+     _ESTREAM_GCC_A_PRINTF(3,0);
 int estream_printf (const char *format, ...) 
      _ESTREAM_GCC_A_PRINTF(1,2);
 int estream_fprintf (FILE *fp, const char *format, ... )
@@ -74,6 +83,25 @@ int estream_asprintf (char **bufp, const char *format, ...)
      _ESTREAM_GCC_A_PRINTF(2,3);
 int estream_vasprintf (char **bufp, const char *format, va_list arg_ptr)
      _ESTREAM_GCC_A_PRINTF(2,0);
+int estream_snprintf_shortest (char *buf, size_t bufsize, int conv,
+                              double value);
+
+size_t estream_ulltoa (char *buffer, unsigned long long value);
+
+/* The async-signal-safe estream_safe_* functions are declared in
+   estream.h.  */
+
+/* Pre-parsed format strings for repeated use.  */
+typedef struct estream_format_s *estream_format_t;
+
+estream_format_t estream_format_compile (const char *format);
+void estream_format_release (estream_format_t fmt);
+int estream_format_exec (estream_printf_out_t outfnc, void *outfncarg,
+                         estream_format_t fmt, va_list vaargs);
+int estream_format_values (estream_printf_out_t outfnc, void *outfncarg,
+                           estream_format_t fmt,
+                           const struct es_valueitem_s *values,
+                           size_t nvalues);
 
 #ifdef __cplusplus
 }
@@ -52,8 +52,13 @@
  */
 
 
+#define ES__NO_PRINTF_SPECIALIZATION 1
 #include <estream.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <limits.h>
+#include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -96,6 +101,12 @@ typedef void (*func_free_t) (void *mem);
 #define BUFFER_BLOCK_SIZE  BUFSIZ
 #define BUFFER_UNREAD_SIZE 16
 
+/* Number of iovec elements es_writev handles without malloc.  */
+#define WRITEV_LOCAL_IOVECS 16
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
 
 /* Locking.  */
 
@@ -169,9 +180,13 @@ struct estream_internal
   unsigned int stdstream_fd:2;   /* 0, 1 or 2 for a standard stream.  */
   unsigned int print_err: 1;     /* Error in print_fun_writer.  */
   unsigned int printable_fname_inuse: 1;  /* es_fname_get has been used.  */
+  unsigned int offset_valid: 1;  /* OFFSET is the backend position of the
+                                    buffer start.  */
+  unsigned int stats_timing: 1;  /* Measure STATS.IO_NSEC.  */
   int print_errno;               /* Errno from print_fun_writer.  */
   size_t print_ntotal;           /* Bytes written from in print_fun_writer. */
   FILE *print_fp;                /* Stdio stream used by print_fun_writer.  */
+  struct es_stats_s stats;       /* Counters returned by es_stats.  */
 };
 
 
@@ -327,11 +342,33 @@ es_list_iterate (estream_iterator_t iterator)
  * I/O Helper
  */
 
+/* Print the statistics of STREAM to stderr.  */
+static int
+es_dump_stats (estream_t stream)
+{
+  struct es_stats_s *st = &stream->intern->stats;
+
+  fprintf (stderr, "estream %s: in=%llu out=%llu syscalls=%llu"
+           " fills=%llu flushes=%llu seeks=%llu (%llu buffered)"
+           " unbuffered=%llu io_usec=%llu\n",
+           stream->intern->printable_fname?
+           stream->intern->printable_fname : "[?]",
+           st->bytes_in, st->bytes_out, st->syscalls,
+           st->fills, st->flushes, st->seeks, st->seeks_buffered,
+           st->unbuffered,
+           st->io_nsec / 1000);
+  return 0;
+}
+
 static void
 es_deinit (void)
 {
   /* Flush all streams. */
   es_fflush (NULL);
+
+  /* Report the I/O statistics if requested.  */
+  if (getenv ("ESTREAM_STATS"))
+    es_list_iterate (es_dump_stats);
 }
 
 
@@ -693,12 +730,14 @@ es_func_fd_write (void *cookie, const void *buffer, size_t size)
       ESTREAM_SYS_YIELD ();
       bytes_written = size; /* Yeah:  Success writing to the bit bucket.  */
     }
-  else
+  else if (buffer)
     {
       do
         bytes_written = ESTREAM_SYS_WRITE (file_cookie->fd, buffer, size);
       while (bytes_written == -1 && errno == EINTR);
     }
+  else
+    bytes_written = size; /* A flush event; there is nothing to write.  */
 
   return bytes_written;
 }
@@ -753,6 +792,55 @@ es_func_fd_destroy (void *cookie)
 }
 
 
+/* Gather-write function for fd objects.  Write all IOVCNT buffers
+   described by IOV, retrying on short writes.  IOV is used as scratch
+   space and will be modified.  The number of bytes written is stored
+   at R_WRITTEN and the number of writev calls is added to R_CALLS,
+   both even on error.  */
+static int
+es_func_fd_writev (void *cookie, struct iovec *iov, int iovcnt,
+                   size_t *r_written, unsigned long long *r_calls)
+{
+  estream_cookie_fd_t file_cookie = cookie;
+  size_t data_written = 0;
+  ssize_t ret;
+
+  while (iovcnt)
+    {
+      do
+        {
+          ret = writev (file_cookie->fd, iov,
+                        iovcnt > IOV_MAX? IOV_MAX : iovcnt);
+          (*r_calls)++;
+        }
+      while (ret == -1 && errno == EINTR);
+      if (ret == -1)
+        {
+          *r_written = data_written;
+          return -1;
+        }
+      data_written += ret;
+
+      /* Skip over the fully written buffers and adjust a partially
+         written one.  */
+      while (iovcnt && (size_t)ret >= iov->iov_len)
+        {
+          ret -= iov->iov_len;
+          iov++;
+          iovcnt--;
+        }
+      if (iovcnt)
+        {
+          iov->iov_base = (char *)iov->iov_base + ret;
+          iov->iov_len -= ret;
+        }
+    }
+
+  *r_written = data_written;
+  return 0;
+}
+
+
 static es_cookie_io_functions_t estream_functions_fd =
   {
     es_func_fd_read,
@@ -985,6 +1073,83 @@ es_convert_mode (const char *mode, unsigned int *modeflags)
 
 
 
+/*
+ * Backend calls.  All calls into the cookie functions which do actual
+ * I/O go through these wrappers so that they are accounted in the
+ * stream's statistics.  The time spent is only measured for streams
+ * which asked for it with es_stats_timing, or for all streams if
+ * ESTREAM_STATS is set, as reading the clock costs more than counting.
+ */
+
+/* Whether new streams measure their I/O time: -1 until ESTREAM_STATS
+   has been looked at.  */
+static int stats_timing_default = -1;
+
+/* Return a monotonic timestamp in nanoseconds.  */
+static unsigned long long
+es_time_now (void)
+{
+#ifdef __sun__
+  return gethrtime ();
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static ssize_t
+es_backend_read (estream_t stream, void *buffer, size_t size)
+{
+  unsigned long long start;
+  ssize_t ret;
+
+  start = stream->intern->stats_timing? es_time_now () : 0;
+  ret = (*stream->intern->func_read) (stream->intern->cookie, buffer, size);
+  if (stream->intern->stats_timing)
+    stream->intern->stats.io_nsec += es_time_now () - start;
+  stream->intern->stats.syscalls++;
+  if (ret > 0)
+    stream->intern->stats.bytes_in += ret;
+
+  return ret;
+}
+
+static ssize_t
+es_backend_write (estream_t stream, const void *buffer, size_t size)
+{
+  unsigned long long start;
+  ssize_t ret;
+
+  start = stream->intern->stats_timing? es_time_now () : 0;
+  ret = (*stream->intern->func_write) (stream->intern->cookie, buffer, size);
+  if (stream->intern->stats_timing)
+    stream->intern->stats.io_nsec += es_time_now () - start;
+  stream->intern->stats.syscalls++;
+  if (ret > 0)
+    stream->intern->stats.bytes_out += ret;
+
+  return ret;
+}
+
+static int
+es_backend_seek (estream_t stream, off_t *offset, int whence)
+{
+  unsigned long long start;
+  int ret;
+
+  start = stream->intern->stats_timing? es_time_now () : 0;
+  ret = (*stream->intern->func_seek) (stream->intern->cookie, offset, whence);
+  if (stream->intern->stats_timing)
+    stream->intern->stats.io_nsec += es_time_now () - start;
+  stream->intern->stats.syscalls++;
+
+  return ret;
+}
+
+
+
 /*
  * Low level stream functionality.
  */
@@ -1002,11 +1167,10 @@ es_fill (estream_t stream)
     }
   else
     {
-      es_cookie_read_function_t func_read = stream->intern->func_read;
       ssize_t ret;
 
-      ret = (*func_read) (stream->intern->cookie,
-			  stream->buffer, stream->buffer_size);
+      stream->intern->stats.fills++;
+      ret = es_backend_read (stream, stream->buffer, stream->buffer_size);
       if (ret == -1)
 	{
 	  bytes_read = 0;
@@ -1059,12 +1223,13 @@ es_flush (estream_t stream)
 
       data_flushed = 0;
       err = 0;
+      stream->intern->stats.flushes++;
 
       while ((((ssize_t) (stream->data_offset - data_flushed)) > 0) && (! err))
 	{
-	  ret = (*func_write) (stream->intern->cookie,
-			       stream->buffer + data_flushed,
-			       stream->data_offset - data_flushed);
+	  ret = es_backend_write (stream,
+				  stream->buffer + data_flushed,
+				  stream->data_offset - data_flushed);
 	  if (ret == -1)
 	    {
 	      bytes_written = 0;
@@ -1079,13 +1244,16 @@ es_flush (estream_t stream)
 	}
 
       stream->data_flushed += data_flushed;
+      if ((stream->intern->modeflags & O_APPEND))
+        stream->intern->offset_valid = 0;
       if (stream->data_offset == data_flushed)
 	{
 	  stream->intern->offset += stream->data_offset;
 	  stream->data_offset = 0;
 	  stream->data_flushed = 0;
 
-	  /* Propagate flush event.  */
+	  /* Propagate flush event.  This is not an I/O request and thus
+	     not counted in the statistics.  */
 	  (*func_write) (stream->intern->cookie, NULL, 0);
 	}
     }
@@ -1105,6 +1273,8 @@ static void
 es_empty (estream_t stream)
 {
   assert (!stream->flags.writing);
+  /* The backend has already delivered the discarded data.  */
+  stream->intern->offset += stream->data_len;
   stream->data_len = 0;
   stream->data_offset = 0;
   stream->unread_data_len = 0;
@@ -1118,7 +1288,12 @@ es_initialize (estream_t stream,
 {
   stream->intern->cookie = cookie;
   stream->intern->opaque = NULL;
+  stream->intern->modeflags = modeflags;
   stream->intern->offset = 0;
+  stream->intern->offset_valid = 0;
+  if (stats_timing_default == -1)
+    stats_timing_default = !!getenv ("ESTREAM_STATS");
+  stream->intern->stats_timing = stats_timing_default;
   stream->intern->func_read = functions.func_read;
   stream->intern->func_write = functions.func_write;
   stream->intern->func_seek = functions.func_seek;
@@ -1137,6 +1312,7 @@ es_initialize (estream_t stream,
   stream->intern->deallocate_buffer = 0;
   stream->intern->printable_fname = NULL;
   stream->intern->printable_fname_inuse = 0;
+  memset (&stream->intern->stats, 0, sizeof stream->intern->stats);
 
   stream->data_len = 0;
   stream->data_offset = 0;
@@ -1264,18 +1440,18 @@ es_read_nbf (estream_t ES__RESTRICT stream,
 	     unsigned char *ES__RESTRICT buffer,
 	     size_t bytes_to_read, size_t *ES__RESTRICT bytes_read)
 {
-  es_cookie_read_function_t func_read = stream->intern->func_read;
   size_t data_read;
   ssize_t ret;
   int err;
 
   data_read = 0;
   err = 0;
+  stream->intern->stats.unbuffered++;
 
   while (bytes_to_read - data_read)
     {
-      ret = (*func_read) (stream->intern->cookie,
-			  buffer + data_read, bytes_to_read - data_read);
+      ret = es_backend_read (stream,
+			     buffer + data_read, bytes_to_read - data_read);
       if (ret == -1)
 	{
 	  err = -1;
@@ -1427,6 +1603,7 @@ es_seek (estream_t ES__RESTRICT stream, off_t offset, int whence,
   int err, ret;
   off_t off;
 
+  stream->intern->stats.seeks++;
   if (! func_seek)
     {
       _set_errno (EOPNOTSUPP);
@@ -1451,7 +1628,7 @@ es_seek (estream_t ES__RESTRICT stream, off_t offset, int whence,
       off -= stream->unread_data_len;
     }
 
-  ret = (*func_seek) (stream->intern->cookie, &off, whence);
+  ret = es_backend_seek (stream, &off, whence);
   if (ret == -1)
     {
       err = -1;
@@ -1466,6 +1643,7 @@ es_seek (estream_t ES__RESTRICT stream, off_t offset, int whence,
 
   stream->intern->indicators.eof = 0;
   stream->intern->offset = off;
+  stream->intern->offset_valid = 1;
 
  out:
 
@@ -1475,6 +1653,37 @@ es_seek (estream_t ES__RESTRICT stream, off_t offset, int whence,
   return err;
 }
 
+/* Try to satisfy a seek in STREAM by only moving the offset within
+   the read buffer.  Returns true if that was possible; in this case no
+   backend call has been done.  Absolute targets can only be checked
+   if we know the backend position of the buffer.  */
+static int
+es_seek_buffered (estream_t stream, off_t offset, int whence)
+{
+  off_t pos;
+
+  if (stream->flags.writing
+      || stream->unread_data_len
+      || !stream->intern->func_seek)
+    return 0;
+
+  if (whence == SEEK_CUR)
+    pos = (off_t)stream->data_offset + offset;
+  else if (whence == SEEK_SET && stream->intern->offset_valid)
+    pos = offset - stream->intern->offset;
+  else
+    return 0;
+
+  if (pos < 0 || pos > (off_t)stream->data_len)
+    return 0;
+
+  stream->data_offset = pos;
+  stream->intern->indicators.eof = 0;
+  stream->intern->stats.seeks++;
+  stream->intern->stats.seeks_buffered++;
+  return 1;
+}
+
 /* Write BYTES_TO_WRITE bytes from BUFFER into STREAM in
    unbuffered-mode, storing the amount of bytes written in
    *BYTES_WRITTEN.  */
@@ -1496,12 +1705,13 @@ es_write_nbf (estream_t ES__RESTRICT stream,
 
   data_written = 0;
   err = 0;
+  stream->intern->stats.unbuffered++;
 
   while (bytes_to_write - data_written)
     {
-      ret = (*func_write) (stream->intern->cookie,
-			   buffer + data_written,
-			   bytes_to_write - data_written);
+      ret = es_backend_write (stream,
+			      buffer + data_written,
+			      bytes_to_write - data_written);
       if (ret == -1)
 	{
 	  err = -1;
@@ -1512,6 +1722,8 @@ es_write_nbf (estream_t ES__RESTRICT stream,
     }
 
   stream->intern->offset += data_written;
+  if ((stream->intern->modeflags & O_APPEND))
+    stream->intern->offset_valid = 0;
   *bytes_written = data_written;
 
  out:
@@ -1598,6 +1810,26 @@ es_write_lbf (estream_t ES__RESTRICT stream,
 }
 
 
+/* Prepare STREAM for writing.  If STREAM is in reading mode this
+   discards input data and seeks to the position at which reading has
+   stopped.  We can do this only if a seek function has been
+   registered.  */
+static int
+es_prepare_write (estream_t stream)
+{
+  int err = 0;
+
+  if (!stream->flags.writing && stream->intern->func_seek)
+    {
+      err = es_seek (stream, 0, SEEK_CUR, NULL);
+      if (err && errno == ESPIPE)
+        err = 0;
+    }
+
+  return err;
+}
+
+
 /* Write BYTES_TO_WRITE bytes from BUFFER into STREAM in, storing the
    amount of bytes written in BYTES_WRITTEN.  */
 static int
@@ -1609,25 +1841,10 @@ es_writen (estream_t ES__RESTRICT stream,
   int err;
 
   data_written = 0;
-  err = 0;
 
-  if (!stream->flags.writing)
-    {
-      /* Switching to writing mode -> discard input data and seek to
-	 position at which reading has stopped.  We can do this only
-	 if a seek function has been registered. */
-      if (stream->intern->func_seek)
-        {
-          err = es_seek (stream, 0, SEEK_CUR, NULL);
-          if (err)
-            {
-              if (errno == ESPIPE)
-                err = 0;
-              else
-                goto out;
-            }
-        }
-    }
+  err = es_prepare_write (stream);
+  if (err)
+    goto out;
 
   switch (stream->intern->strategy)
     {
@@ -1656,6 +1873,127 @@ es_writen (estream_t ES__RESTRICT stream,
 }
 
 
+/* Write the IOVCNT buffers described by IOV into STREAM, storing the
+   amount of bytes written in BYTES_WRITTEN.  If the data does not fit
+   into the buffer of an fd based stream, the buffered data and all of
+   IOV are handed to the kernel with a single writev.  Otherwise this
+   is the same as calling es_writen for each buffer.  */
+static int
+es_writevn (estream_t ES__RESTRICT stream,
+            const struct iovec *iov, int iovcnt,
+            size_t *ES__RESTRICT bytes_written)
+{
+  struct iovec iov_buffer[WRITEV_LOCAL_IOVECS];
+  struct iovec *iov_new;
+  estream_cookie_fd_t fd_cookie;
+  size_t total, data_written, nwritten;
+  unsigned long long start;
+  int i, err;
+
+  data_written = 0;
+  err = 0;
+
+  total = 0;
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (total + iov[i].iov_len < total)
+        {
+          _set_errno (EINVAL);
+          err = -1;
+          goto out;
+        }
+      total += iov[i].iov_len;
+    }
+
+  fd_cookie = stream->intern->cookie;
+  if (stream->intern->func_write != es_func_fd_write
+      || IS_INVALID_FD (fd_cookie->fd)
+      || (stream->flags.writing
+          && total <= stream->buffer_size - stream->data_offset)
+      || (!stream->flags.writing && total <= stream->buffer_size))
+    {
+      /* The data fits into the buffer or this is not an fd stream;
+         use the regular buffered write for each element.  */
+      for (i = 0; i < iovcnt && !err; i++)
+        {
+          nwritten = 0;
+          err = es_writen (stream, iov[i].iov_base, iov[i].iov_len,
+                           &nwritten);
+          data_written += nwritten;
+        }
+      goto out;
+    }
+
+  err = es_prepare_write (stream);
+  if (err)
+    goto out;
+
+  /* Put the already buffered data in front of the caller's buffers.  */
+  if (iovcnt + 1 > WRITEV_LOCAL_IOVECS)
+    {
+      iov_new = mem_alloc ((iovcnt + 1) * sizeof *iov_new);
+      if (!iov_new)
+        {
+          err = -1;
+          goto out;
+        }
+    }
+  else
+    iov_new = iov_buffer;
+  iov_new[0].iov_base = stream->buffer;
+  iov_new[0].iov_len = stream->flags.writing? stream->data_offset : 0;
+  memcpy (iov_new + 1, iov, iovcnt * sizeof *iov);
+
+  nwritten = 0;
+  start = stream->intern->stats_timing? es_time_now () : 0;
+  err = es_func_fd_writev (fd_cookie, iov_new, iovcnt + 1, &nwritten,
+                           &stream->intern->stats.syscalls);
+  if (stream->intern->stats_timing)
+    stream->intern->stats.io_nsec += es_time_now () - start;
+  stream->intern->stats.unbuffered++;
+  stream->intern->stats.bytes_out += nwritten;
+  if (iov_new != iov_buffer)
+    mem_free (iov_new);
+
+  stream->intern->offset += nwritten;
+  if ((stream->intern->modeflags & O_APPEND))
+    stream->intern->offset_valid = 0;
+  if (stream->flags.writing)
+    {
+      if (nwritten >= stream->data_offset)
+        {
+          nwritten -= stream->data_offset;
+          stream->data_offset = 0;
+          stream->data_flushed = 0;
+        }
+      else
+        {
+          /* Not even the buffered data went out.  Keep the remaining
+             part buffered so that a later flush can retry; the offset
+             of the buffer start has advanced by what was written.  */
+          memmove (stream->buffer, stream->buffer + nwritten,
+                   stream->data_offset - nwritten);
+          stream->data_offset -= nwritten;
+          nwritten = 0;
+        }
+    }
+  data_written = nwritten;
+  stream->flags.writing = 1;
+
+ out:
+
+  if (err)
+    stream->intern->indicators.err = 1;
+  if (bytes_written)
+    *bytes_written = data_written;
+  if (data_written)
+    if (!stream->flags.writing)
+      stream->flags.writing = 1;
+
+  return err;
+}
+
+
 static int
 es_peek (estream_t ES__RESTRICT stream, unsigned char **ES__RESTRICT data,
 	 size_t *ES__RESTRICT data_len)
@@ -1870,6 +2208,20 @@ es_print (estream_t ES__RESTRICT stream,
 }
 
 
+/* Same as es_print but using the compiled format FMT.  */
+static int
+es_print_compiled (estream_t ES__RESTRICT stream, es_format_t fmt, va_list ap)
+{
+  int rc;
+
+  stream->intern->print_ntotal = 0;
+  rc = estream_format_exec (print_writer, stream, fmt, ap);
+  if (rc)
+    return -1;
+  return (int)stream->intern->print_ntotal;
+}
+
+
 static void
 es_set_indicators (estream_t stream, int ind_err, int ind_eof)
 {
@@ -1999,6 +2351,7 @@ es_fopen (const char *ES__RESTRICT path, const char *ES__RESTRICT mode)
   err = es_create (&stream, cookie, fd, estream_functions_fd, modeflags, 0);
   if (err)
     goto out;
+  stream->intern->offset_valid = 1;
 
   if (stream && path)
     fname_set_internal (stream, path, 1);
@@ -2211,6 +2564,39 @@ es_fileno (estream_t stream)
 
 
 
+int
+es_stats (estream_t stream, struct es_stats_s *r_stats)
+{
+  if (!stream || !r_stats)
+    {
+      _set_errno (EINVAL);
+      return -1;
+    }
+
+  ESTREAM_LOCK (stream);
+  *r_stats = stream->intern->stats;
+  ESTREAM_UNLOCK (stream);
+
+  return 0;
+}
+
+
+/* Switch the measurement of the I/O time of STREAM on if ON is set or
+   off otherwise.  Returns the previous setting.  */
+int
+es_stats_timing (estream_t stream, int on)
+{
+  int old;
+
+  ESTREAM_LOCK (stream);
+  old = stream->intern->stats_timing;
+  stream->intern->stats_timing = !!on;
+  ESTREAM_UNLOCK (stream);
+
+  return old;
+}
+
+
 int
 es_ferror_unlocked (estream_t stream)
 {
@@ -2288,7 +2674,10 @@ es_fseek (estream_t stream, long int offset, int whence)
   int err;
 
   ESTREAM_LOCK (stream);
-  err = es_seek (stream, offset, whence, NULL);
+  if (es_seek_buffered (stream, offset, whence))
+    err = 0;
+  else
+    err = es_seek (stream, offset, whence, NULL);
   ESTREAM_UNLOCK (stream);
 
   return err;
@@ -2301,7 +2690,10 @@ es_fseeko (estream_t stream, off_t offset, int whence)
   int err;
 
   ESTREAM_LOCK (stream);
-  err = es_seek (stream, offset, whence, NULL);
+  if (es_seek_buffered (stream, offset, whence))
+    err = 0;
+  else
+    err = es_seek (stream, offset, whence, NULL);
   ESTREAM_UNLOCK (stream);
 
   return err;
@@ -2347,6 +2739,35 @@ es_write (estream_t ES__RESTRICT stream,
 }
 
 
+int
+es_writev (estream_t ES__RESTRICT stream,
+           const struct iovec *iov, int iovcnt,
+           size_t *ES__RESTRICT bytes_written)
+{
+  int err;
+
+  if (iovcnt < 0)
+    {
+      _set_errno (EINVAL);
+      err = -1;
+    }
+  else if (iovcnt)
+    {
+      ESTREAM_LOCK (stream);
+      err = es_writevn (stream, iov, iovcnt, bytes_written);
+      ESTREAM_UNLOCK (stream);
+    }
+  else
+    {
+      if (bytes_written)
+        *bytes_written = 0;
+      err = 0;
+    }
+
+  return err;
+}
+
+
 size_t
 es_fread (void *ES__RESTRICT ptr, size_t size, size_t nitems,
 	  estream_t ES__RESTRICT stream)
@@ -2444,6 +2865,358 @@ es_getline (char *ES__RESTRICT *ES__RESTRICT lineptr, size_t *ES__RESTRICT n,
 }
 
 
+/*
+ * Line index.
+ */
+
+/* Magic at the start of a saved line index.  The file is written in
+   host byte order; it is a cache and not meant to be portable.  */
+#define LINEIDX_MAGIC "ESLIDX01"
+
+/* The header of a saved line index.  It is followed by COUNT
+   offsets.  */
+struct lineidx_header_s
+{
+  char magic[8];
+  unsigned int every;
+  unsigned int reserved;
+  unsigned long long nlines;
+  unsigned long long size;
+  long long mtime;
+  unsigned long long count;
+};
+
+/* A sparse index with the offset of every EVERY-th line of a file.  */
+struct es_lineidx_s
+{
+  unsigned int every;        /* Distance between indexed lines.  */
+  unsigned long long nlines; /* Number of lines in the file.  */
+  unsigned long long size;   /* Size of the indexed file.  */
+  long long mtime;           /* Modification time of the file or -1.  */
+  size_t count;              /* Number of items in OFFSETS.  */
+  size_t alloced;            /* Allocated items of OFFSETS.  */
+  off_t *offsets;            /* OFFSETS[N] is the start of line N*EVERY. */
+};
+
+
+/* Get the size and modification time of the file backing STREAM.
+   Returns -1 if STREAM has no file descriptor.  */
+static int
+lineidx_stat (estream_t stream, unsigned long long *r_size,
+              long long *r_mtime)
+{
+  struct stat st;
+
+  if (IS_INVALID_FD (stream->intern->fd)
+      || fstat (stream->intern->fd, &st))
+    return -1;
+  *r_size = st.st_size;
+  *r_mtime = st.st_mtime;
+  return 0;
+}
+
+
+/* Append OFFSET to the offsets of IDX.  */
+static int
+lineidx_add (es_lineidx_t idx, off_t offset)
+{
+  if (idx->count == idx->alloced)
+    {
+      size_t n = idx->alloced? 2 * idx->alloced : 64;
+      off_t *p;
+
+      if (n < idx->alloced || n > ((size_t)-1) / sizeof *p)
+        {
+          _set_errno (ENOMEM);
+          return -1;
+        }
+      p = mem_realloc (idx->offsets, n * sizeof *p);
+      if (!p)
+        return -1;
+      idx->offsets = p;
+      idx->alloced = n;
+    }
+  idx->offsets[idx->count++] = offset;
+  return 0;
+}
+
+
+/* Scan all of STREAM and fill IDX.  This is called in locked state.  */
+static int
+lineidx_scan (estream_t stream, es_lineidx_t idx)
+{
+  unsigned char *data, *p, *nl;
+  size_t data_len;
+  unsigned long long lineno = 0;
+  off_t pos = 0;
+  int last = '\n';
+  int err;
+
+  err = es_seek (stream, 0, SEEK_SET, NULL);
+  if (err)
+    return err;
+
+  while (!(err = es_peek (stream, &data, &data_len)) && data_len)
+    {
+      for (p = data; (nl = memchr (p, '\n', data_len - (p - data))); p = nl+1)
+        {
+          /* NL ends line LINENO; a line starting after it is only
+             indexed here and removed again if the file ends.  */
+          if (!(++lineno % idx->every)
+              && lineidx_add (idx, pos + (nl - data) + 1))
+            return -1;
+        }
+      last = data[data_len - 1];
+      pos += data_len;
+      es_skip (stream, data_len);
+    }
+  if (err)
+    return err;
+
+  if (last == '\n')
+    {
+      /* No partial last line.  */
+      if (lineno && !(lineno % idx->every))
+        idx->count--;
+    }
+  else
+    lineno++;
+
+  idx->nlines = lineno;
+  idx->size = pos;
+  return 0;
+}
+
+
+/* Create a sparse line index for STREAM with the offset of every
+   EVERY-th line.  This reads the entire stream, which must be
+   seekable.  Returns NULL on error.  */
+es_lineidx_t
+es_lineidx_build (estream_t stream, unsigned int every)
+{
+  es_lineidx_t idx;
+  unsigned long long size;
+  int err;
+
+  if (!every)
+    {
+      _set_errno (EINVAL);
+      return NULL;
+    }
+  idx = mem_alloc (sizeof *idx);
+  if (!idx)
+    return NULL;
+  idx->every = every;
+  idx->count = 0;
+  idx->alloced = 0;
+  idx->offsets = NULL;
+  err = lineidx_add (idx, 0);  /* Line 0 always starts at 0.  */
+  if (!err)
+    {
+      ESTREAM_LOCK (stream);
+      err = lineidx_scan (stream, idx);
+      if (err || lineidx_stat (stream, &size, &idx->mtime)
+          || size != idx->size)
+        idx->mtime = -1; /* Can't check whether a saved copy is fresh. */
+      ESTREAM_UNLOCK (stream);
+    }
+  if (err)
+    {
+      es_lineidx_free (idx);
+      return NULL;
+    }
+
+  return idx;
+}
+
+
+/* Store IDX in the file FNAME for use by es_lineidx_open.  */
+int
+es_lineidx_save (es_lineidx_t idx, const char *fname)
+{
+  struct lineidx_header_s hdr;
+  estream_t fp;
+  unsigned long long offset;
+  size_t n;
+  int err;
+
+  memset (&hdr, 0, sizeof hdr);
+  memcpy (hdr.magic, LINEIDX_MAGIC, sizeof hdr.magic);
+  hdr.every = idx->every;
+  hdr.nlines = idx->nlines;
+  hdr.size = idx->size;
+  hdr.mtime = idx->mtime;
+  hdr.count = idx->count;
+
+  fp = es_fopen (fname, "wb");
+  if (!fp)
+    return -1;
+  err = es_write (fp, &hdr, sizeof hdr, NULL);
+  for (n = 0; !err && n < idx->count; n++)
+    {
+      offset = idx->offsets[n];
+      err = es_write (fp, &offset, sizeof offset, NULL);
+    }
+  if (es_fclose (fp))
+    err = -1;
+
+  return err;
+}
+
+
+/* Load the line index from FNAME.  Returns NULL if it can't be read or
+   does not describe the current state of STREAM.  */
+static es_lineidx_t
+lineidx_load (estream_t stream, const char *fname, unsigned int every)
+{
+  struct lineidx_header_s hdr;
+  es_lineidx_t idx = NULL;
+  unsigned long long size, offset;
+  long long mtime;
+  estream_t fp;
+  size_t n, nread;
+
+  if (lineidx_stat (stream, &size, &mtime))
+    return NULL;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return NULL;
+  if (es_read (fp, &hdr, sizeof hdr, &nread) || nread != sizeof hdr
+      || memcmp (hdr.magic, LINEIDX_MAGIC, sizeof hdr.magic)
+      || hdr.every != every || hdr.size != size || hdr.mtime != mtime
+      || mtime == -1 || !hdr.count || hdr.count > size + 1)
+    goto leave;
+
+  idx = mem_alloc (sizeof *idx);
+  if (!idx)
+    goto leave;
+  idx->every = hdr.every;
+  idx->nlines = hdr.nlines;
+  idx->size = hdr.size;
+  idx->mtime = hdr.mtime;
+  idx->count = 0;
+  idx->alloced = hdr.count;
+  idx->offsets = mem_alloc (hdr.count * sizeof *idx->offsets);
+  if (!idx->offsets)
+    goto leave;
+  for (n = 0; n < hdr.count; n++)
+    {
+      if (es_read (fp, &offset, sizeof offset, &nread)
+          || nread != sizeof offset || offset > size)
+        goto leave;
+      idx->offsets[idx->count++] = offset;
+    }
+  es_fclose (fp);
+  return idx;
+
+ leave:
+  es_fclose (fp);
+  es_lineidx_free (idx);
+  return NULL;
+}
+
+
+/* Return a line index for STREAM with an offset for every EVERY-th
+   line.  If FNAME holds an index for the same EVERY and the size and
+   modification time of the file backing STREAM are unchanged, that
+   index is used.  Otherwise a new index is built and, if possible,
+   saved to FNAME.  */
+es_lineidx_t
+es_lineidx_open (estream_t stream, const char *fname, unsigned int every)
+{
+  es_lineidx_t idx;
+
+  idx = lineidx_load (stream, fname, every);
+  if (idx)
+    return idx;
+
+  idx = es_lineidx_build (stream, every);
+  if (idx && idx->mtime != -1)
+    es_lineidx_save (idx, fname);
+
+  return idx;
+}
+
+
+/* Return the number of lines described by IDX.  */
+unsigned long long
+es_lineidx_lines (es_lineidx_t idx)
+{
+  return idx->nlines;
+}
+
+
+/* Position STREAM at the start of line LINENO, counting from 0, using
+   the index IDX.  At most EVERY-1 lines need to be scanned after
+   seeking to the closest indexed line.  */
+int
+es_lineidx_seek (estream_t stream, es_lineidx_t idx,
+                 unsigned long long lineno)
+{
+  unsigned long long skip;
+  unsigned char *data, *nl;
+  size_t data_len, slot;
+  off_t offset;
+  int err;
+
+  if (lineno >= idx->nlines)
+    {
+      _set_errno (EINVAL);
+      return -1;
+    }
+  slot = lineno / idx->every;
+  skip = lineno % idx->every;
+  if (slot >= idx->count)
+    {
+      _set_errno (EINVAL);
+      return -1;
+    }
+  offset = idx->offsets[slot];
+
+  ESTREAM_LOCK (stream);
+  if (es_seek_buffered (stream, offset, SEEK_SET))
+    err = 0;
+  else
+    err = es_seek (stream, offset, SEEK_SET, NULL);
+  while (!err && skip)
+    {
+      err = es_peek (stream, &data, &data_len);
+      if (err)
+        break;
+      if (!data_len)
+        {
+          /* The file has been truncated.  */
+          _set_errno (EINVAL);
+          err = -1;
+          break;
+        }
+      nl = memchr (data, '\n', data_len);
+      if (nl)
+        {
+          data_len = nl - data + 1;
+          skip--;
+        }
+      es_skip (stream, data_len);
+    }
+  ESTREAM_UNLOCK (stream);
+
+  return err;
+}
+
+
+/* Release the line index IDX.  */
+void
+es_lineidx_free (es_lineidx_t idx)
+{
+  if (idx)
+    {
+      mem_free (idx->offsets);
+      mem_free (idx);
+    }
+}
+
+
 /* Wrapper around free() to match the memory allocation system used
    by estream.  Should be used for all buffers returned to the caller
    by libestream. */
@@ -2509,6 +3282,163 @@ es_fprintf (estream_t ES__RESTRICT stream,
 }
 
 
+/* Helpers for the es_fprintf macro in estream.h.  Each writes one
+   converted value and an optional newline, the same as es_fprintf
+   would do for the matching format.  */
+static int
+es_print_buffer (estream_t stream, const char *buffer, size_t length)
+{
+  size_t nwritten = 0;
+  int err;
+
+  ESTREAM_LOCK (stream);
+  err = es_writen (stream, buffer, length, &nwritten);
+  ESTREAM_UNLOCK (stream);
+
+  return err? -1 : (int)nwritten;
+}
+
+
+int
+_es_print_signed (estream_t stream, long long value, int newline)
+{
+  char buffer[22];
+  size_t n = 0;
+
+  if (value < 0)
+    buffer[n++] = '-';
+  n += estream_ulltoa (buffer + n, value < 0? -(unsigned long long)value
+                                            : (unsigned long long)value);
+  if (newline)
+    buffer[n++] = '\n';
+  return es_print_buffer (stream, buffer, n);
+}
+
+
+int
+_es_print_unsigned (estream_t stream, unsigned long long value, int newline)
+{
+  char buffer[21];
+  size_t n;
+
+  n = estream_ulltoa (buffer, value);
+  if (newline)
+    buffer[n++] = '\n';
+  return es_print_buffer (stream, buffer, n);
+}
+
+
+int
+_es_print_string (estream_t stream, const char *string, int newline)
+{
+  size_t nwritten = 0;
+  int err;
+
+  if (!string)
+    string = "(null)";
+  ESTREAM_LOCK (stream);
+  err = es_writen (stream, string, strlen (string), &nwritten);
+  if (!err && newline)
+    {
+      size_t n;
+
+      err = es_writen (stream, "\n", 1, &n);
+      nwritten += n;
+    }
+  ESTREAM_UNLOCK (stream);
+
+  return err? -1 : (int)nwritten;
+}
+
+
+/* Parse FORMAT once so that it may be used with es_fprintf_compiled
+   any number of times.  The returned object is not modified by its
+   use and may be shared among threads.  Returns NULL and sets ERRNO
+   for an invalid FORMAT.  */
+es_format_t
+es_format_compile (const char *format)
+{
+  return estream_format_compile (format);
+}
+
+
+void
+es_format_release (es_format_t fmt)
+{
+  estream_format_release (fmt);
+}
+
+
+int
+es_vfprintf_compiled (estream_t ES__RESTRICT stream, es_format_t fmt,
+		      va_list ap)
+{
+  int ret;
+
+  if (!fmt)
+    {
+      _set_errno (EINVAL);
+      return -1;
+    }
+
+  ESTREAM_LOCK (stream);
+  ret = es_print_compiled (stream, fmt, ap);
+  ESTREAM_UNLOCK (stream);
+
+  return ret;
+}
+
+
+/* Print VALUE to BUF with the shortest digits which read back to the
+   same double; see estream_snprintf_shortest.  */
+int
+es_fmt_double_shortest (char *buf, size_t bufsize, int conv, double value)
+{
+  return estream_snprintf_shortest (buf, bufsize, conv, value);
+}
+
+
+/* Print the NVALUES typed VALUES according to the compiled format
+   FMT to STREAM; see estream_format_values.  */
+int
+es_fprintf_values (estream_t ES__RESTRICT stream, es_format_t fmt,
+		   const struct es_valueitem_s *values, size_t nvalues)
+{
+  int ret;
+
+  if (!fmt)
+    {
+      _set_errno (EINVAL);
+      return -1;
+    }
+
+  ESTREAM_LOCK (stream);
+  stream->intern->print_ntotal = 0;
+  ret = estream_format_values (print_writer, stream, fmt, values, nvalues);
+  if (!ret)
+    ret = (int)stream->intern->print_ntotal;
+  else
+    ret = -1;
+  ESTREAM_UNLOCK (stream);
+
+  return ret;
+}
+
+
+int
+es_fprintf_compiled (estream_t ES__RESTRICT stream, es_format_t fmt, ...)
+{
+  int ret;
+
+  va_list ap;
+  va_start (ap, fmt);
+  ret = es_vfprintf_compiled (stream, fmt, ap);
+  va_end (ap);
+
+  return ret;
+}
+
+
 int
 es_setvbuf (estream_t ES__RESTRICT stream,
 	    char *ES__RESTRICT buf, int type, size_t size)
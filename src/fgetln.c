@@ -15,45 +15,114 @@
  */
 
 /*
- * portable fgetln() version, NOT reentrant
+ * portable fgetln() version
+ *
+ * Each thread keeps a line buffer per FILE it reads with fgetln(), in a
+ * most recently used list behind a pthread key, so no lock is needed
+ * and streams read from different threads never share a buffer.  A
+ * buffer is released when fgetln() reports end of file or an error on
+ * its stream, as that is I/O on the stream which ends the validity of
+ * the last line anyway, and all of a thread's buffers when it exits
+ * (the main thread's at exit()).  Streams closed before their end leave
+ * their buffers behind, so the list holds at most FGETLN_MAX entries:
+ * a thread reading yet another stream takes over the buffer of the one
+ * it used least recently, whose last line is then no longer valid.
  */
 
+#include <sys/types.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
+
+#define	FGETLN_MAX	16
+
+struct fgetln_buf {
+	struct fgetln_buf	*next;
+	FILE			*fp;
+	char			*buf;
+	size_t			 bufsz;
+};
+
+static pthread_key_t fgetln_key;
+static pthread_once_t fgetln_once = PTHREAD_ONCE_INIT;
+static int fgetln_key_error;
+
+static void
+fgetln_destroy(void *arg)
+{
+	struct fgetln_buf *b, *next;
+
+	for (b = arg; b != NULL; b = next) {
+		next = b->next;
+		free(b->buf);
+		free(b);
+	}
+}
+
+/* thread destructors are not run for the main thread */
+static void
+fgetln_exit(void)
+{
+	fgetln_destroy(pthread_getspecific(fgetln_key));
+	pthread_setspecific(fgetln_key, NULL);
+}
+
+static void
+fgetln_init(void)
+{
+	fgetln_key_error = pthread_key_create(&fgetln_key, fgetln_destroy);
+	if (fgetln_key_error == 0)
+		(void)atexit(fgetln_exit);
+}
 
 char *
 fgetln(FILE *fp, size_t *len)
 {
-	static char *buf = NULL;
-	static size_t bufsz = 0;
-	size_t r = 0;
-	char *p;
-	int c, e;
+	struct fgetln_buf *head, *b, **bp, **lru = NULL;
+	ssize_t r;
+	int e, n = 0;
 
 	if (!fp || !len) {
 		errno = EINVAL;
 		return NULL;
 	}
-	if (!buf) {
-		if (!(buf = calloc(1, BUFSIZ)))
-			return NULL;
-		bufsz = BUFSIZ;
+	if (pthread_once(&fgetln_once, fgetln_init) != 0 ||
+	    fgetln_key_error != 0) {
+		errno = ENOMEM;
+		return NULL;
 	}
-	while ((c = getc(fp)) != EOF) {
-		buf[r++] = c;
-		if (r == bufsz) {
-			if (!(p = reallocarray(buf, 2, bufsz))) {
-				e = errno;
-				free(buf);
-				errno = e;
-				buf = NULL, bufsz = 0;
-				return NULL;
-			}
-			buf = p, bufsz = 2 * bufsz;
-		}
-		if (c == '\n')
+	head = pthread_getspecific(fgetln_key);
+	for (bp = &head; (b = *bp) != NULL; bp = &b->next) {
+		if (b->fp == fp)
 			break;
+		lru = bp;
+		n++;
+	}
+	if (b != NULL)
+		*bp = b->next;
+	else if (n >= FGETLN_MAX) {
+		/* take over the buffer of the least recently used stream */
+		b = *lru;
+		*lru = NULL;
+		b->fp = fp;
+	} else if ((b = calloc(1, sizeof(*b))) == NULL)
+		return NULL;
+	else
+		b->fp = fp;
+
+	r = getdelim(&b->buf, &b->bufsz, '\n', fp);
+	if (r <= 0) {
+		e = errno;
+		free(b->buf);
+		free(b);
+		pthread_setspecific(fgetln_key, head);
+		errno = e;
+		*len = 0;
+		return NULL;
 	}
-	return (*len = r) ? buf : NULL;
+	b->next = head;
+	pthread_setspecific(fgetln_key, b);
+	*len = r;
+	return b->buf;
 }
@@ -34,12 +34,80 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
 
+/*
+ * Make room for need more bytes plus the terminating NUL behind off.
+ */
+static int
+getdelim_grow(char **buf, size_t *bufsiz, size_t off, size_t need)
+{
+	char *nbuf;
+	size_t nbufsiz;
+
+	if (off + need < *bufsiz)
+		return 0;
+	for (nbufsiz = *bufsiz; off + need >= nbufsiz; nbufsiz *= 2)
+		if (nbufsiz > SIZE_MAX / 2) {
+			errno = EOVERFLOW;
+			return -1;
+		}
+	if ((nbuf = realloc(*buf, nbufsiz)) == NULL)
+		return -1;
+	*buf = nbuf;
+	*bufsiz = nbufsiz;
+	return 0;
+}
+
+#if !defined(__sun__) || defined(_LP64)
+/*
+ * Read a newline terminated line with fgets(), which copies whole runs
+ * out of the stdio buffer.  The chunk handed to fgets() is filled with
+ * newlines first: as fgets() stops after the first newline it copies,
+ * the NUL it appends is the last byte in the chunk that is not a
+ * newline, which finds the end even if the line contains NULs.
+ */
+static ssize_t
+getline_fgets(char **buf, size_t *bufsiz, FILE *fp)
+{
+	size_t off = 0, chunk = 128;
+	char *p, *q;
+
+	for (;;) {
+		if (getdelim_grow(buf, bufsiz, off, chunk) == -1)
+			return -1;
+		p = *buf + off;
+		memset(p, '\n', chunk);
+		if (fgets(p, chunk, fp) == NULL) {
+			if (ferror(fp) || off == 0)
+				return -1;
+			break;
+		}
+		for (q = p + chunk - 1; *q == '\n'; q--)
+			continue;
+		off += q - p;
+		if (q[-1] == '\n')
+			break;
+		if (chunk < 64 * 1024)
+			chunk *= 2;
+	}
+	(*buf)[off] = '\0';
+	return off;
+}
+#endif
+
+/*
+ * The stream is locked once for the whole line.  Where the FILE layout
+ * is public (the 32 bit Solaris ABI) the stdio buffer is scanned with
+ * memchr and whole runs are copied out.  Elsewhere FILE is opaque, so
+ * lines are read with fgets(), which does the same inside stdio, and
+ * only other delimiters fall back to getc_unlocked.
+ */
 ssize_t
 getdelim(char **buf, size_t *bufsiz, int delimiter, FILE *fp)
 {
-	char *ptr, *eptr;
-
+	size_t off = 0;
+	int c;
 
 	if (*buf == NULL || *bufsiz == 0) {
 		*bufsiz = BUFSIZ;
@@ -47,31 +115,55 @@ getdelim(char **buf, size_t *bufsiz, int delimiter, FILE *fp)
 			return -1;
 	}
 
-	for (ptr = *buf, eptr = *buf + *bufsiz;;) {
-		int c = fgetc(fp);
-		if (c == -1) {
-			if (feof(fp))
-				return ptr == *buf ? -1 : ptr - *buf;
-			else
-				return -1;
-		}
-		*ptr++ = c;
-		if (c == delimiter) {
-			*ptr = '\0';
-			return ptr - *buf;
+	flockfile(fp);
+#if !defined(__sun__) || defined(_LP64)
+	if (delimiter == '\n') {
+		ssize_t r = getline_fgets(buf, bufsiz, fp);
+
+		funlockfile(fp);
+		return r;
+	}
+#endif
+	for (;;) {
+#if defined(__sun__) && !defined(_LP64)
+		if (fp->_cnt > 0) {
+			unsigned char *p = fp->_ptr, *q;
+			size_t n = fp->_cnt;
+
+			if ((q = memchr(p, delimiter, n)) != NULL)
+				n = q - p + 1;
+			if (getdelim_grow(buf, bufsiz, off, n) == -1)
+				goto error;
+			memcpy(*buf + off, p, n);
+			off += n;
+			fp->_ptr += n;
+			fp->_cnt -= n;
+			if (q != NULL)
+				break;
+			continue;
 		}
-		if (ptr + 2 >= eptr) {
-			char *nbuf;
-			size_t nbufsiz = *bufsiz * 2;
-			ssize_t d = ptr - *buf;
-			if ((nbuf = realloc(*buf, nbufsiz)) == NULL)
-				return -1;
-			*buf = nbuf;
-			*bufsiz = nbufsiz;
-			eptr = nbuf + nbufsiz;
-			ptr = nbuf + d;
+		c = __filbuf(fp);
+#else
+		c = getc_unlocked(fp);
+#endif
+		if (c == EOF) {
+			if (ferror(fp) || off == 0)
+				goto error;
+			break;
 		}
+		if (getdelim_grow(buf, bufsiz, off, 1) == -1)
+			goto error;
+		(*buf)[off++] = c;
+		if (c == delimiter)
+			break;
 	}
+	funlockfile(fp);
+	(*buf)[off] = '\0';
+	return off;
+
+error:
+	funlockfile(fp);
+	return -1;
 }
 
 ssize_t
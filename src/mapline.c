@@ -0,0 +1,223 @@
+/*
+ * Zero-copy line iteration over memory mapped files.
+ *
+ * ml_next() hands out (pointer, length) views into the mapping instead
+ * of copying each line like getline() and fgetln() do.  ml_foreach()
+ * optionally splits the file at line boundaries and walks the pieces
+ * in parallel threads.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mapline.h"
+
+#define	ML_MAXTHREADS	64
+
+struct _maplines {
+	char	*ml_base;
+	size_t	 ml_size;
+	size_t	 ml_off;	/* start of the next line */
+};
+
+struct ml_chunk {
+	const char	*start;
+	const char	*end;
+	unsigned int	 id;
+	ml_func_t	 fn;
+	void		*arg;
+	int		 ret;
+};
+
+/*
+ * Find the next newline in [p, end); 16 bytes per step with SSE2.
+ */
+static const char *
+ml_findnl(const char *p, const char *end)
+{
+#ifdef __SSE2__
+	const __m128i nl = _mm_set1_epi8('\n');
+	int mask;
+
+	for (; end - p >= 16; p += 16) {
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+		    _mm_loadu_si128((const __m128i *)p), nl));
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	return memchr(p, '\n', end - p);
+}
+
+MapLines *
+ml_fdopen(int fd)
+{
+	MapLines *ml;
+	struct stat st;
+	int e;
+
+	if (fstat(fd, &st) == -1)
+		return NULL;
+	if (!S_ISREG(st.st_mode)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	/* a 32 bit process cannot map a file beyond SIZE_MAX */
+	if ((uintmax_t)st.st_size > SIZE_MAX) {
+		errno = EFBIG;
+		return NULL;
+	}
+	if ((ml = calloc(1, sizeof(*ml))) == NULL)
+		return NULL;
+	ml->ml_size = st.st_size;
+	if (ml->ml_size == 0)
+		return ml;
+	ml->ml_base = mmap(NULL, ml->ml_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (ml->ml_base == MAP_FAILED) {
+		e = errno;
+		free(ml);
+		errno = e;
+		return NULL;
+	}
+#ifdef MADV_SEQUENTIAL
+	(void)madvise(ml->ml_base, ml->ml_size, MADV_SEQUENTIAL);
+#endif
+	return ml;
+}
+
+MapLines *
+ml_open(const char *path)
+{
+	MapLines *ml;
+	int fd, e;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	ml = ml_fdopen(fd);
+	e = errno;
+	close(fd);
+	errno = e;
+	return ml;
+}
+
+const char *
+ml_next(MapLines *ml, size_t *len)
+{
+	const char *p, *end, *nl;
+
+	if (ml->ml_off >= ml->ml_size)
+		return NULL;
+	p = ml->ml_base + ml->ml_off;
+	end = ml->ml_base + ml->ml_size;
+	nl = ml_findnl(p, end);
+	*len = (nl != NULL ? nl + 1 : end) - p;
+	ml->ml_off += *len;
+	return p;
+}
+
+void
+ml_rewind(MapLines *ml)
+{
+	ml->ml_off = 0;
+}
+
+static void *
+ml_walk(void *arg)
+{
+	struct ml_chunk *c = arg;
+	const char *p, *nl;
+	size_t len;
+
+	for (p = c->start; p < c->end; p += len) {
+		nl = ml_findnl(p, c->end);
+		len = (nl != NULL ? nl + 1 : c->end) - p;
+		if ((c->ret = c->fn(p, len, c->id, c->arg)) != 0)
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * Call fn for every line, ignoring the ml_next() position.  With
+ * nthreads > 1 the file is split into as many pieces, each ending at a
+ * line boundary, and fn is called concurrently with the index of the
+ * calling thread.  A piece stops at the first non-zero return of fn,
+ * which is passed back; other pieces run to their end.
+ */
+int
+ml_foreach(MapLines *ml, unsigned int nthreads, ml_func_t fn, void *arg)
+{
+	struct ml_chunk c[ML_MAXTHREADS];
+	pthread_t tid[ML_MAXTHREADS];
+	const char *p, *end, *nl;
+	unsigned int i, n, started;
+
+	if (nthreads == 0)
+		nthreads = 1;
+	if (nthreads > ML_MAXTHREADS)
+		nthreads = ML_MAXTHREADS;
+	if (nthreads > ml->ml_size / 4096 + 1)
+		nthreads = ml->ml_size / 4096 + 1;
+
+	p = ml->ml_base;
+	end = ml->ml_base + ml->ml_size;
+	for (n = 0; n < nthreads && p < end; n++) {
+		c[n].start = p;
+		if (n == nthreads - 1)
+			p = end;
+		else {
+			p += (end - p) / (nthreads - n);
+			if ((nl = ml_findnl(p, end)) != NULL)
+				p = nl + 1;
+			else
+				p = end;
+		}
+		c[n].end = p;
+		c[n].id = n;
+		c[n].fn = fn;
+		c[n].arg = arg;
+		c[n].ret = 0;
+	}
+	if (n == 0)
+		return 0;
+
+	for (started = 1; started < n; started++)
+		if (pthread_create(&tid[started], NULL, ml_walk,
+		    &c[started]) != 0)
+			break;
+	/* the first piece, and any whose thread failed to start, run here */
+	ml_walk(&c[0]);
+	for (i = started; i < n; i++)
+		ml_walk(&c[i]);
+	for (i = 1; i < started; i++)
+		pthread_join(tid[i], NULL);
+
+	for (i = 0; i < n; i++)
+		if (c[i].ret != 0)
+			return c[i].ret;
+	return 0;
+}
+
+int
+ml_close(MapLines *ml)
+{
+	int r = 0;
+
+	if (ml == NULL)
+		return 0;
+	if (ml->ml_base != NULL)
+		r = munmap(ml->ml_base, ml->ml_size);
+	free(ml);
+	return r;
+}
@@ -0,0 +1,262 @@
+/*
+ * Multi-pattern matching over a StringList.
+ *
+ * sl_match_init() compiles the strings of a list into an Aho-Corasick
+ * automaton, so that one pass over the input checks it against every
+ * pattern instead of one sl_find() or strcasestr() call per string.
+ * The bytes that occur in the patterns are mapped to a small number of
+ * classes, all others share one, and the transitions are stored as a
+ * complete table of states by classes: matching costs two loads per
+ * input byte whatever the number of patterns.
+ *
+ * The matcher keeps the string pointers of the list as they were when
+ * it was compiled; the strings must stay valid while it is in use.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stringlist.h>
+
+struct _slmatcher {
+	int		  slm_flags;
+	size_t		  slm_nstr;
+	char		**slm_str;	/* the patterns */
+	size_t		 *slm_len;	/* and their lengths */
+	size_t		  slm_ncls;	/* byte classes */
+	uint32_t	 *slm_delta;	/* state * slm_ncls + class -> state */
+	uint32_t	 *slm_depth;	/* length of the path to a state */
+	int32_t		 *slm_out;	/* longest pattern ending there, or -1 */
+	unsigned char	  slm_cls[256];
+};
+
+static int
+slm_fold(const SLMatcher *m, int c)
+{
+	return (m->slm_flags & SL_MATCH_ICASE) ? tolower(c) : c;
+}
+
+/*
+ * Resize the per-state tables from oldcap to newcap states, clearing
+ * the new ones.
+ */
+static int
+slm_resize(SLMatcher *m, uint32_t oldcap, uint32_t newcap)
+{
+	size_t ncls = m->slm_ncls;
+	uint32_t *delta, *depth;
+	int32_t *out;
+
+	if ((delta = reallocarray(m->slm_delta, newcap,
+	    ncls * sizeof(*delta))) == NULL)
+		return -1;
+	m->slm_delta = delta;
+	if ((depth = reallocarray(m->slm_depth, newcap,
+	    sizeof(*depth))) == NULL)
+		return -1;
+	m->slm_depth = depth;
+	if ((out = reallocarray(m->slm_out, newcap, sizeof(*out))) == NULL)
+		return -1;
+	m->slm_out = out;
+	if (newcap > oldcap) {
+		memset(delta + oldcap * ncls, 0,
+		    (newcap - oldcap) * ncls * sizeof(*delta));
+		memset(depth + oldcap, 0, (newcap - oldcap) * sizeof(*depth));
+		memset(out + oldcap, 0xff, (newcap - oldcap) * sizeof(*out));
+	}
+	return 0;
+}
+
+/*
+ * Turn the trie into the automaton: in breadth first order every
+ * missing transition is replaced by the one of the failure state, and
+ * each state inherits the output of its failure state if it has none.
+ */
+static int
+slm_link(SLMatcher *m, uint32_t nstates)
+{
+	uint32_t *fail, *queue, head, tail, s, t;
+	size_t c, ncls = m->slm_ncls;
+
+	fail = calloc(nstates, sizeof(*fail));
+	queue = reallocarray(NULL, nstates, sizeof(*queue));
+	if (fail == NULL || queue == NULL) {
+		free(fail);
+		free(queue);
+		return -1;
+	}
+	head = tail = 0;
+	queue[tail++] = 0;
+	while (head < tail) {
+		s = queue[head++];
+		for (c = 0; c < ncls; c++) {
+			t = m->slm_delta[s * ncls + c];
+			if (t != 0 && m->slm_depth[t] == m->slm_depth[s] + 1) {
+				fail[t] = s == 0 ? 0 :
+				    m->slm_delta[fail[s] * ncls + c];
+				if (m->slm_out[t] == -1)
+					m->slm_out[t] = m->slm_out[fail[t]];
+				queue[tail++] = t;
+			} else if (s != 0)
+				m->slm_delta[s * ncls + c] =
+				    m->slm_delta[fail[s] * ncls + c];
+		}
+	}
+	free(fail);
+	free(queue);
+	return 0;
+}
+
+SLMatcher *
+sl_match_init(StringList *sl, int flags)
+{
+	SLMatcher *m;
+	size_t i, total = 0, ncls;
+	uint32_t nstates, cap, n, s;
+	size_t k;
+	const unsigned char *p;
+	unsigned char used[256];
+	int c, e;
+
+	if ((flags & (SL_MATCH_EXACT | SL_MATCH_SUBSTR)) == 0 ||
+	    (flags & SL_MATCH_EXACT && flags & SL_MATCH_SUBSTR) ||
+	    (flags & ~(SL_MATCH_EXACT | SL_MATCH_SUBSTR | SL_MATCH_ICASE))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((m = calloc(1, sizeof(*m))) == NULL)
+		return NULL;
+	m->slm_flags = flags;
+	m->slm_nstr = sl->sl_cur;
+	m->slm_str = reallocarray(NULL, sl->sl_cur + 1, sizeof(char *));
+	m->slm_len = reallocarray(NULL, sl->sl_cur + 1, sizeof(size_t));
+	if (m->slm_str == NULL || m->slm_len == NULL)
+		goto fail;
+
+	/* byte classes; class 0 stands for bytes in no pattern */
+	memset(used, 0, sizeof(used));
+	for (i = 0; i < sl->sl_cur; i++) {
+		m->slm_str[i] = sl->sl_str[i];
+		m->slm_len[i] = strlen(sl->sl_str[i]);
+		total += m->slm_len[i];
+		for (p = (unsigned char *)sl->sl_str[i]; *p; p++)
+			used[slm_fold(m, *p)] = 1;
+	}
+	if (total >= UINT32_MAX) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	for (c = 0, ncls = 1; c < 256; c++)
+		if (used[c])
+			used[c] = ncls++;
+	for (c = 0; c < 256; c++)
+		m->slm_cls[c] = used[slm_fold(m, c)];
+	m->slm_ncls = ncls;
+
+	/*
+	 * The trie; state 0 is the root and no edge leads back to it.  The
+	 * tables grow as states are added, as shared prefixes usually leave
+	 * far fewer states than pattern bytes, and are trimmed at the end.
+	 */
+	nstates = 1;
+	cap = total + 1 < 64 ? total + 1 : 64;
+	if (slm_resize(m, 0, cap) == -1)
+		goto fail;
+	for (i = 0; i < m->slm_nstr; i++) {
+		s = 0;
+		for (p = (unsigned char *)m->slm_str[i]; *p; p++) {
+			k = s * ncls + m->slm_cls[*p];
+			if (m->slm_delta[k] == 0) {
+				if (nstates == cap) {
+					n = cap > (total + 1) / 2 ?
+					    total + 1 : cap * 2;
+					if (slm_resize(m, cap, n) == -1)
+						goto fail;
+					cap = n;
+				}
+				m->slm_depth[nstates] = m->slm_depth[s] + 1;
+				m->slm_delta[k] = nstates++;
+			}
+			s = m->slm_delta[k];
+		}
+		if (m->slm_out[s] == -1)
+			m->slm_out[s] = i;
+	}
+	/* failing to shrink leaves larger tables, which is harmless */
+	if (nstates < cap)
+		(void)slm_resize(m, cap, nstates);
+
+	if (flags & SL_MATCH_SUBSTR && slm_link(m, nstates) == -1)
+		goto fail;
+	return m;
+
+fail:
+	e = errno;
+	sl_match_free(m);
+	errno = e;
+	return NULL;
+}
+
+/*
+ * Match the len bytes at s.  In SL_MATCH_SUBSTR mode the pattern whose
+ * occurrence ends first is returned, the longest if several end at the
+ * same byte, and its offset is stored in *offp if offp is not NULL.
+ */
+char *
+sl_matchn(SLMatcher *m, const char *s, size_t len, size_t *offp)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	const uint32_t *delta = m->slm_delta;
+	size_t i, ncls = m->slm_ncls;
+	uint32_t st = 0;
+	int32_t o;
+
+	if (m->slm_flags & SL_MATCH_EXACT) {
+		for (i = 0; i < len; i++)
+			if ((st = delta[st * ncls + m->slm_cls[p[i]]]) == 0)
+				return NULL;
+		if ((o = m->slm_out[st]) == -1)
+			return NULL;
+		if (offp != NULL)
+			*offp = 0;
+		return m->slm_str[o];
+	}
+
+	if ((o = m->slm_out[0]) != -1)
+		i = 0;
+	else
+		for (i = 0; i < len; i++) {
+			st = delta[st * ncls + m->slm_cls[p[i]]];
+			if ((o = m->slm_out[st]) != -1) {
+				i++;
+				break;
+			}
+		}
+	if (o == -1)
+		return NULL;
+	if (offp != NULL)
+		*offp = i - m->slm_len[o];
+	return m->slm_str[o];
+}
+
+char *
+sl_match(SLMatcher *m, const char *s, size_t *offp)
+{
+	return sl_matchn(m, s, strlen(s), offp);
+}
+
+void
+sl_match_free(SLMatcher *m)
+{
+	if (m == NULL)
+		return;
+	free(m->slm_str);
+	free(m->slm_len);
+	free(m->slm_delta);
+	free(m->slm_depth);
+	free(m->slm_out);
+	free(m);
+}
@@ -33,28 +33,18 @@
  * SUCH DAMAGE.
  */
 
-#include <ctype.h>
+#include <stdint.h>
 #include <string.h>
 
+#include "strsearch.h"
+
 /*
  * Find the first occurrence of find in s, ignore case.
  */
 char *
 strcasestr(const char *s, const char *find)
 {
-	char c, sc;
-	size_t len;
-
-	if ((c = *find++) != 0) {
-		c = (char)tolower((unsigned char)c);
-		len = strlen(find);
-		do {
-			do {
-				if ((sc = *s++) == 0)
-					return (NULL);
-			} while ((char)tolower((unsigned char)sc) != c);
-		} while (strncasecmp(s, find, len) != 0);
-		s--;
-	}
-	return ((char *)s);
+	if (*find == '\0')
+		return ((char *)s);
+	return (_strsearch_str(s, SIZE_MAX, find, strlen(find), 1));
 }
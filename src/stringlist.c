@@ -48,6 +48,186 @@ __weak_alias(sl_delete,_sl_delete)
 #endif
 
 #define _SL_CHUNKSIZE	20
+#define _SL_INDEXMIN	64
+
+/*
+ * Optional index of a hashed string list: an open addressing table,
+ * probed linearly, from string to its first occurrence in sl_str.  It
+ * is built on the first sl_find() or sl_delete() and kept up to date by
+ * sl_add() from then on.  Entries hold string pointers, not positions,
+ * so that deletions do not have to renumber them.
+ */
+struct sl_slot {
+	char	*str;		/* first occurrence, NULL if free */
+	size_t	 hash;
+	size_t	 dups;		/* number of later equal strings */
+};
+
+struct _sl_index {
+	struct sl_slot	*slots;
+	size_t		 mask;
+	size_t		 used;
+	int		 built;
+};
+
+static size_t
+sl_hash(const char *s)
+{
+	size_t h = (size_t)2166136261U;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+static struct sl_slot *
+sl_index_lookup(struct _sl_index *idx, const char *name, size_t h)
+{
+	size_t i;
+
+	for (i = h & idx->mask; idx->slots[i].str != NULL;
+	    i = (i + 1) & idx->mask)
+		if (idx->slots[i].hash == h &&
+		    strcmp(idx->slots[i].str, name) == 0)
+			return &idx->slots[i];
+	return NULL;
+}
+
+static int
+sl_index_resize(struct _sl_index *idx, size_t size)
+{
+	struct sl_slot *old = idx->slots, *new;
+	size_t i, j, oldsize = old ? idx->mask + 1 : 0;
+
+	if ((new = calloc(size, sizeof(*new))) == NULL)
+		return -1;
+	for (i = 0; i < oldsize; i++) {
+		if (old[i].str == NULL)
+			continue;
+		for (j = old[i].hash & (size - 1); new[j].str != NULL;
+		    j = (j + 1) & (size - 1))
+			continue;
+		new[j] = old[i];
+	}
+	free(old);
+	idx->slots = new;
+	idx->mask = size - 1;
+	return 0;
+}
+
+static int
+sl_index_insert(struct _sl_index *idx, char *name)
+{
+	struct sl_slot *slot;
+	size_t h = sl_hash(name), i;
+
+	if ((slot = sl_index_lookup(idx, name, h)) != NULL) {
+		slot->dups++;
+		return 0;
+	}
+	/* keep the load factor at or below one half */
+	if ((idx->used + 1) * 2 > idx->mask + 1 &&
+	    sl_index_resize(idx, (idx->mask + 1) * 2) == -1)
+		return -1;
+	for (i = h & idx->mask; idx->slots[i].str != NULL;
+	    i = (i + 1) & idx->mask)
+		continue;
+	idx->slots[i].str = name;
+	idx->slots[i].hash = h;
+	idx->slots[i].dups = 0;
+	idx->used++;
+	return 0;
+}
+
+/*
+ * Free a slot, moving later entries of the probe run back so that no
+ * tombstones are needed.
+ */
+static void
+sl_index_remove(struct _sl_index *idx, struct sl_slot *slot)
+{
+	size_t i = slot - idx->slots, j = i, k;
+
+	for (;;) {
+		j = (j + 1) & idx->mask;
+		if (idx->slots[j].str == NULL)
+			break;
+		k = idx->slots[j].hash & idx->mask;
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			idx->slots[i] = idx->slots[j];
+			i = j;
+		}
+	}
+	idx->slots[i].str = NULL;
+	idx->used--;
+}
+
+static int
+sl_index_build(StringList *sl)
+{
+	struct _sl_index *idx = sl->sl_index;
+	size_t i, size;
+
+	for (size = _SL_INDEXMIN; size < sl->sl_cur * 2; size *= 2)
+		continue;
+	if (sl_index_resize(idx, size) == -1)
+		return -1;
+	idx->used = 0;
+	for (i = 0; i < sl->sl_cur; i++)
+		if (sl_index_insert(idx, sl->sl_str[i]) == -1) {
+			free(idx->slots);
+			idx->slots = NULL;
+			return -1;
+		}
+	idx->built = 1;
+	return 0;
+}
+
+/*
+ * Whether the index of sl can be used, building it if needed.
+ */
+static int
+sl_indexed(StringList *sl)
+{
+	if (sl->sl_index == NULL)
+		return 0;
+	return sl->sl_index->built || sl_index_build(sl) == 0;
+}
+
+/*
+ * Strings copied by sl_add_copy() are stored back to back in a chain of
+ * chunks, each twice the size of the previous one, and released
+ * together by sl_free().
+ */
+#define _SL_ARENAMIN	4096
+
+struct _sl_arena {
+	struct _sl_arena	*next;
+	size_t			 size;
+	size_t			 used;
+	char			 data[];
+};
+
+static int
+sl_in_arena(const StringList *sl, const char *p)
+{
+	const struct _sl_arena *a;
+
+	for (a = sl->sl_arena; a != NULL; a = a->next)
+		if (p >= a->data && p < a->data + a->size)
+			return 1;
+	return 0;
+}
+
+/*
+ * Free a string unless it belongs to the arena.
+ */
+static void
+sl_release(StringList *sl, char *p)
+{
+	if (sl->sl_arena == NULL || !sl_in_arena(sl, p))
+		free(p);
+}
 
 /*
  * sl_init(): Initialize a string list
@@ -63,6 +243,8 @@ sl_init(void)
 
 	sl->sl_cur = 0;
 	sl->sl_max = _SL_CHUNKSIZE;
+	sl->sl_index = NULL;
+	sl->sl_arena = NULL;
 	sl->sl_str = reallocarray(NULL, sl->sl_max, sizeof(char *));
 	if (sl->sl_str == NULL) {
 		free(sl);
@@ -71,6 +253,24 @@ sl_init(void)
 	return sl;
 }
 
+/*
+ * sl_init_hashed(): Initialize a string list with a hash index for
+ * sl_find() and sl_delete()
+ */
+StringList *
+sl_init_hashed(void)
+{
+	StringList *sl;
+
+	if ((sl = sl_init()) == NULL)
+		return NULL;
+	if ((sl->sl_index = calloc(1, sizeof(*sl->sl_index))) == NULL) {
+		sl_free(sl, 0);
+		return NULL;
+	}
+	return sl;
+}
+
 
 /*
  * sl_add(): Add an item to the string list
@@ -84,17 +284,49 @@ sl_add(StringList *sl, char *name)
 	if (sl->sl_cur == sl->sl_max - 1) {
 		char	**new;
 
-		new = reallocarray(sl->sl_str,
-		    (sl->sl_max + _SL_CHUNKSIZE), sizeof(char *));
+		new = reallocarray(sl->sl_str, sl->sl_max, 2 * sizeof(char *));
 		if (new == NULL)
 			return -1;
-		sl->sl_max += _SL_CHUNKSIZE;
+		sl->sl_max *= 2;
 		sl->sl_str = new;
 	}
+	if (sl->sl_index != NULL && sl->sl_index->built &&
+	    sl_index_insert(sl->sl_index, name) == -1)
+		return -1;
 	sl->sl_str[sl->sl_cur++] = name;
 	return 0;
 }
 
+/*
+ * sl_add_copy(): Add a copy of an item, stored in the list's arena
+ */
+int
+sl_add_copy(StringList *sl, const char *name)
+{
+	struct _sl_arena *a = sl->sl_arena;
+	size_t len = strlen(name) + 1, size;
+	char *p;
+
+	_DIAGASSERT(sl != NULL);
+
+	if (a == NULL || a->size - a->used < len) {
+		size = a != NULL ? a->size * 2 : _SL_ARENAMIN;
+		while (size < len)
+			size *= 2;
+		if ((a = malloc(sizeof(*a) + size)) == NULL)
+			return -1;
+		a->next = sl->sl_arena;
+		a->size = size;
+		a->used = 0;
+		sl->sl_arena = a;
+	}
+	p = memcpy(a->data + a->used, name, len);
+	if (sl_add(sl, p) == -1)
+		return -1;
+	a->used += len;
+	return 0;
+}
+
 
 /*
  * sl_free(): Free a stringlist
@@ -102,6 +334,7 @@ sl_add(StringList *sl, char *name)
 void
 sl_free(StringList *sl, int all)
 {
+	struct _sl_arena *a;
 	size_t i;
 
 	if (sl == NULL)
@@ -109,9 +342,17 @@ sl_free(StringList *sl, int all)
 	if (sl->sl_str) {
 		if (all)
 			for (i = 0; i < sl->sl_cur; i++)
-				free(sl->sl_str[i]);
+				sl_release(sl, sl->sl_str[i]);
 		free(sl->sl_str);
 	}
+	while ((a = sl->sl_arena) != NULL) {
+		sl->sl_arena = a->next;
+		free(a);
+	}
+	if (sl->sl_index) {
+		free(sl->sl_index->slots);
+		free(sl->sl_index);
+	}
 	free(sl);
 }
 
@@ -122,10 +363,16 @@ sl_free(StringList *sl, int all)
 char *
 sl_find(StringList *sl, const char *name)
 {
+	struct sl_slot *slot;
 	size_t i;
 
 	_DIAGASSERT(sl != NULL);
 
+	if (sl_indexed(sl)) {
+		slot = sl_index_lookup(sl->sl_index, name, sl_hash(name));
+		return slot ? slot->str : NULL;
+	}
+
 	for (i = 0; i < sl->sl_cur; i++)
 		if (strcmp(sl->sl_str[i], name) == 0)
 			return sl->sl_str[i];
@@ -133,18 +380,46 @@ sl_find(StringList *sl, const char *name)
 	return NULL;
 }
 
+/*
+ * Remove the entry at position i, keeping the order of the others.
+ */
+static void
+sl_remove(StringList *sl, size_t i, int all)
+{
+	if (all)
+		sl_release(sl, sl->sl_str[i]);
+	memmove(&sl->sl_str[i], &sl->sl_str[i + 1],
+	    (sl->sl_cur - i - 1) * sizeof(char *));
+	sl->sl_str[--sl->sl_cur] = NULL;
+}
+
 int
 sl_delete(StringList *sl, const char *name, int all)
 {
+	struct sl_slot *slot;
 	size_t i, j;
 
+	if (sl_indexed(sl)) {
+		slot = sl_index_lookup(sl->sl_index, name, sl_hash(name));
+		if (slot == NULL)
+			return -1;
+		/* pointer compares only, no strcmp */
+		for (i = 0; sl->sl_str[i] != slot->str; i++)
+			continue;
+		if (slot->dups > 0) {
+			for (j = i + 1; strcmp(sl->sl_str[j], name) != 0; j++)
+				continue;
+			slot->str = sl->sl_str[j];
+			slot->dups--;
+		} else
+			sl_index_remove(sl->sl_index, slot);
+		sl_remove(sl, i, all);
+		return 0;
+	}
+
 	for (i = 0; i < sl->sl_cur; i++)
 		if (strcmp(sl->sl_str[i], name) == 0) {
-			if (all)
-				free(sl->sl_str[i]);
-			for (j = i + 1; j < sl->sl_cur; j++)
-				sl->sl_str[j - 1] = sl->sl_str[j];
-			sl->sl_str[--sl->sl_cur] = NULL;
+			sl_remove(sl, i, all);
 			return 0;
 		}
 	return -1;
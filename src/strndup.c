@@ -7,9 +7,8 @@ strndup(const char *str, size_t n)
     size_t len;
     char *copy;
 
-    len = strlen(str);
-    if (len <= n)
-        return strdup(str);
+    /* never look at more than n bytes of str */
+    len = strnlen(str, n);
     if ((copy = malloc(len + 1)) == NULL)
         return (NULL);
     memcpy(copy, str, len);
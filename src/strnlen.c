@@ -1,12 +1,56 @@
 #include <stdint.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Scan a word (or a 16 byte vector) at a time once p is aligned.  An
+ * aligned load never crosses a page boundary, so reading a vector that
+ * extends past maxlen cannot fault; the SWAR loop only reads whole
+ * words within the bound.
+ */
+#define	ONES	((unsigned long)-1 / 0xff)
+#define	HIGHS	(ONES << 7)
+#define	HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
 
 size_t
 strnlen(const char *s, size_t maxlen)
 {
-	size_t len;
-	for (len = 0; len < maxlen; len++, s++) {
-		if (!*s) break;
+	const char *p = s;
+	size_t n = maxlen;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int mask, k;
+
+	for (; n > 0 && ((uintptr_t)p & 15) != 0; n--, p++)
+		if (*p == '\0')
+			return (p - s);
+	for (; n > 0; p += 16, n -= 16) {
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+		    _mm_load_si128((const __m128i *)p), zero));
+		if (mask != 0) {
+			k = __builtin_ctz(mask);
+			return (k < n ? (size_t)(p - s) + k : maxlen);
+		}
+		if (n <= 16)
+			break;
+	}
+	return (maxlen);
+#else
+	unsigned long w;
+
+	for (; n > 0 && ((uintptr_t)p & (sizeof(w) - 1)) != 0; n--, p++)
+		if (*p == '\0')
+			return (p - s);
+	for (; n >= sizeof(w); n -= sizeof(w), p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		if (HASZERO(w))
+			break;
 	}
-	return (len);
+	for (; n > 0; n--, p++)
+		if (*p == '\0')
+			break;
+	return (p - s);
+#endif
 }
@@ -33,6 +33,8 @@
 
 #include <string.h>
 
+#include "strsearch.h"
+
 /*
  * Find the first occurrence of find in s, where the search is limited to the
  * first slen characters of s.
@@ -40,20 +42,8 @@
 char *
 strnstr(const char *s, const char *find, size_t slen)
 {
-	char c, sc;
-	size_t len;
-
-	if ((c = *find++) != '\0') {
-		len = strlen(find);
-		do {
-			do {
-				if (slen-- < 1 || (sc = *s++) == '\0')
-					return (NULL);
-			} while (sc != c);
-			if (len > slen)
-				return (NULL);
-		} while (strncmp(s, find, len) != 0);
-		s--;
-	}
-	return ((char *)s);
+	if (*find == '\0')
+		return ((char *)s);
+	/* never look past the first NUL or slen bytes of s */
+	return (_strsearch_str(s, slen, find, strlen(find), 0));
 }
@@ -0,0 +1,222 @@
+/*
+ * Substring search shared by strnstr() and strcasestr().
+ *
+ * Candidates are found by comparing the first and the last byte of the
+ * needle against a whole vector of haystack positions at once, and only
+ * positions where both match are compared in full.  SSE2 is used when
+ * the compiler targets it; AVX2 is picked at run time on x86 CPUs that
+ * have it.  Other targets, and the tail of the haystack, use a plain
+ * loop with the same filter.
+ *
+ * For case-insensitive searches each filter byte is compared against
+ * its tolower() and toupper() forms.  That is only equivalent to
+ * strncasecmp() if no other byte folds to the same letter, which holds
+ * for ASCII bytes the locale folds like the C locale does; otherwise
+ * the plain loop with tolower() is used.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define	HAVE_AVX2_DISPATCH
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "strsearch.h"
+
+#define	SEARCH_AVX2_MIN	64
+#define	SEARCH_CHUNK_MIN	256
+#define	SEARCH_CHUNK_MAX	(64 * 1024)
+
+struct search {
+	const unsigned char	*s;
+	const char		*find;
+	size_t			 m;
+	int			 icase;
+	unsigned char		 f0, f1;	/* forms of the first byte */
+	unsigned char		 l0, l1;	/* forms of the last byte */
+};
+
+static inline int
+search_match(const struct search *sp, size_t i)
+{
+	if (sp->icase)
+		return strncasecmp((const char *)sp->s + i, sp->find,
+		    sp->m) == 0;
+	return memcmp(sp->s + i, sp->find, sp->m) == 0;
+}
+
+/*
+ * Store the tolower() and toupper() forms of c, and return whether c is
+ * ASCII and folds like in the C locale, so that no other byte folds to
+ * it.  ASCII non-letters are in neither case class in any locale; for
+ * a letter one call suffices to catch locales that remap it, as the
+ * Turkish ones do for i and I.
+ */
+static int
+fold_forms(int c, unsigned char *lo, unsigned char *up)
+{
+	if (c >= 'a' && c <= 'z') {
+		if (toupper(c) == c - ('a' - 'A')) {
+			*lo = c;
+			*up = c - ('a' - 'A');
+			return 1;
+		}
+	} else if (c >= 'A' && c <= 'Z') {
+		if (tolower(c) == c + ('a' - 'A')) {
+			*lo = c + ('a' - 'A');
+			*up = c;
+			return 1;
+		}
+	} else if (c < 0x80) {
+		*lo = *up = c;
+		return 1;
+	}
+	*lo = tolower(c);
+	*up = toupper(*lo);
+	return 0;
+}
+
+#ifdef __SSE2__
+/*
+ * Scan 16 positions per step from i while both loads stay within the
+ * haystack; returns the first position not scanned, or (size_t)-1 and
+ * the match in *pos.
+ */
+static inline size_t
+search_sse2(const struct search *sp, size_t i, size_t n, size_t *pos)
+{
+	const __m128i f0 = _mm_set1_epi8(sp->f0), f1 = _mm_set1_epi8(sp->f1);
+	const __m128i l0 = _mm_set1_epi8(sp->l0), l1 = _mm_set1_epi8(sp->l1);
+	__m128i a, b;
+	unsigned int mask;
+
+	for (; i + sp->m - 1 + 16 <= n; i += 16) {
+		a = _mm_loadu_si128((const __m128i *)(sp->s + i));
+		b = _mm_loadu_si128((const __m128i *)(sp->s + i + sp->m - 1));
+		a = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+		b = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
+		mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+		for (; mask != 0; mask &= mask - 1)
+			if (search_match(sp, i + __builtin_ctz(mask))) {
+				*pos = i + __builtin_ctz(mask);
+				return (size_t)-1;
+			}
+	}
+	return i;
+}
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+__attribute__((target("avx2"))) static size_t
+search_avx2(const struct search *sp, size_t n, size_t *pos)
+{
+	const __m256i f0 = _mm256_set1_epi8(sp->f0);
+	const __m256i f1 = _mm256_set1_epi8(sp->f1);
+	const __m256i l0 = _mm256_set1_epi8(sp->l0);
+	const __m256i l1 = _mm256_set1_epi8(sp->l1);
+	__m256i a, b;
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + sp->m - 1 + 32 <= n; i += 32) {
+		a = _mm256_loadu_si256((const __m256i *)(sp->s + i));
+		b = _mm256_loadu_si256(
+		    (const __m256i *)(sp->s + i + sp->m - 1));
+		a = _mm256_or_si256(_mm256_cmpeq_epi8(a, f0),
+		    _mm256_cmpeq_epi8(a, f1));
+		b = _mm256_or_si256(_mm256_cmpeq_epi8(b, l0),
+		    _mm256_cmpeq_epi8(b, l1));
+		mask = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+		for (; mask != 0; mask &= mask - 1)
+			if (search_match(sp, i + __builtin_ctz(mask))) {
+				*pos = i + __builtin_ctz(mask);
+				return (size_t)-1;
+			}
+	}
+	return i;
+}
+#endif
+
+char *
+_strsearch(const char *s, size_t n, const char *find, size_t m, int icase)
+{
+	struct search sr;
+	size_t i = 0, pos = 0;
+	unsigned char c;
+	int simd;
+
+	sr.s = (const unsigned char *)s;
+	sr.find = find;
+	sr.m = m;
+	sr.icase = icase;
+	sr.f0 = sr.f1 = find[0];
+	sr.l0 = sr.l1 = find[m - 1];
+	if (icase) {
+		simd = fold_forms(sr.f0, &sr.f0, &sr.f1);
+		if (!fold_forms(sr.l0, &sr.l0, &sr.l1) || !simd)
+			goto tail;
+	}
+
+#ifdef HAVE_AVX2_DISPATCH
+	/* short haystacks, like most header lines, are not worth the call */
+	if (n - m >= SEARCH_AVX2_MIN && __builtin_cpu_supports("avx2") &&
+	    (i = search_avx2(&sr, n, &pos)) == (size_t)-1)
+		return (char *)s + pos;
+#endif
+#ifdef __SSE2__
+	/* what is left after the AVX2 blocks, or everything */
+	if ((i = search_sse2(&sr, i, n, &pos)) == (size_t)-1)
+		return (char *)s + pos;
+#endif
+	for (; i <= n - m; i++) {
+		c = sr.s[i];
+		if ((c == sr.f0 || c == sr.f1) &&
+		    (sr.s[i + m - 1] == sr.l0 || sr.s[i + m - 1] == sr.l1) &&
+		    search_match(&sr, i))
+			return (char *)s + i;
+	}
+	return NULL;
+
+tail:
+	for (; i <= n - m; i++)
+		if (tolower(sr.s[i]) == sr.f0 && search_match(&sr, i))
+			return (char *)s + i;
+	return NULL;
+}
+
+/*
+ * The haystack ends at its first NUL or after slen bytes.  It is
+ * measured and searched in chunks that overlap by m - 1 bytes and grow
+ * up to SEARCH_CHUNK_MAX, so that a match near the start of a long
+ * string is found without measuring all of it first.
+ */
+char *
+_strsearch_str(const char *s, size_t slen, const char *find, size_t m,
+    int icase)
+{
+	size_t chunk = SEARCH_CHUNK_MIN, n;
+	char *p;
+
+	for (;;) {
+		if (chunk < 2 * m)
+			chunk = 2 * m;
+		if (chunk > slen)
+			chunk = slen;
+		n = strnlen(s, chunk);
+		if (n < m)
+			return NULL;
+		if ((p = _strsearch(s, n, find, m, icase)) != NULL)
+			return p;
+		if (n < chunk || n == slen)
+			return NULL;
+		/* every start up to n - m has been tried */
+		s += n - m + 1;
+		slen -= n - m + 1;
+		if (chunk < SEARCH_CHUNK_MAX)
+			chunk *= 2;
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef LIBBSD_STRSEARCH_H
+#define LIBBSD_STRSEARCH_H
+
+#include <sys/types.h>
+
+/*
+ * Find the first occurrence of the m byte needle find in the n byte
+ * haystack s, neither of which may contain a NUL; 0 < m <= n.  With
+ * icase set bytes are compared like strncasecmp() does.
+ */
+char	*_strsearch(const char *s, size_t n, const char *find, size_t m,
+	    int icase);
+
+/*
+ * The same for the string s, of which at most slen bytes are searched,
+ * and the NUL terminated needle find of length m > 0.
+ */
+char	*_strsearch_str(const char *s, size_t slen, const char *find,
+	    size_t m, int icase);
+
+#endif
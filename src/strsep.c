@@ -1,5 +1,27 @@
+#include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Delimiter sets are looked up in a 256 bit map built once per call,
+ * instead of rescanning delim for every character.
+ */
+#define	DELIM_SET(m, c)		((m)[(c) >> 5] |= 1U << ((c) & 31))
+#define	DELIM_ISSET(m, c)	((m)[(c) >> 5] & (1U << ((c) & 31)))
+
+static void
+delim_map(uint32_t map[8], const char *delim)
+{
+	const unsigned char *d;
+
+	memset(map, 0, 8 * sizeof(map[0]));
+	for (d = (const unsigned char *)delim; *d; d++)
+		DELIM_SET(map, *d);
+}
 
 /*
  * Get next token from string *stringp, where tokens are possibly-empty
@@ -15,26 +37,87 @@
 char *
 strsep(char **stringp, const char *delim)
 {
-	char *s;
-	const char *spanp;
-	int c, sc;
+	uint32_t map[8];
+	unsigned char *s;
 	char *tok;
 
-	if ((s = *stringp) == NULL)
+	if ((tok = *stringp) == NULL)
 		return (NULL);
-	for (tok = s;;) {
-		c = *s++;
-		spanp = delim;
-		do {
-			if ((sc = *spanp++) == c) {
-				if (c == 0)
-					s = NULL;
-				else
-					s[-1] = 0;
-				*stringp = s;
-				return (tok);
+	delim_map(map, delim);
+	DELIM_SET(map, 0);
+	for (s = (unsigned char *)tok; !DELIM_ISSET(map, *s); s++)
+		continue;
+	if (*s == 0)
+		*stringp = NULL;
+	else {
+		*s = 0;
+		*stringp = (char *)s + 1;
+	}
+	return (tok);
+}
+
+/*
+ * Split the len bytes at buf into the possibly-empty tokens separated
+ * by characters from delim, as repeated strsep() calls would, without
+ * modifying buf; NULs in buf are ordinary characters.  Up to nspans
+ * tokens are stored in spans, and the total number of tokens is
+ * returned.
+ */
+size_t
+strspans(const char *buf, size_t len, const char *delim,
+    struct strspan *spans, size_t nspans)
+{
+	const unsigned char *p = (const unsigned char *)buf, *tok = p;
+	const unsigned char *end = p + len;
+	uint32_t map[8];
+	size_t n = 0;
+#ifdef __SSE2__
+	size_t dlen = strlen(delim);
+
+	/* up to four delimiters are compared 16 bytes at a time */
+	if (dlen > 0 && dlen <= 4) {
+		__m128i d0, d1, d2, d3, v, eq;
+		unsigned int mask;
+
+		d0 = _mm_set1_epi8(delim[0]);
+		d1 = _mm_set1_epi8(delim[dlen > 1 ? 1 : 0]);
+		d2 = _mm_set1_epi8(delim[dlen > 2 ? 2 : 0]);
+		d3 = _mm_set1_epi8(delim[dlen > 3 ? 3 : 0]);
+		for (; end - p >= 16; p += 16) {
+			v = _mm_loadu_si128((const __m128i *)p);
+			eq = _mm_or_si128(
+			    _mm_or_si128(_mm_cmpeq_epi8(v, d0),
+			    _mm_cmpeq_epi8(v, d1)),
+			    _mm_or_si128(_mm_cmpeq_epi8(v, d2),
+			    _mm_cmpeq_epi8(v, d3)));
+			mask = _mm_movemask_epi8(eq);
+			for (; mask != 0; mask &= mask - 1) {
+				const unsigned char *q =
+				    p + __builtin_ctz(mask);
+
+				if (n < nspans) {
+					spans[n].ss_str = (const char *)tok;
+					spans[n].ss_len = q - tok;
+				}
+				n++;
+				tok = q + 1;
+			}
+		}
+	}
+#endif
+	delim_map(map, delim);
+	for (; p < end; p++)
+		if (DELIM_ISSET(map, *p)) {
+			if (n < nspans) {
+				spans[n].ss_str = (const char *)tok;
+				spans[n].ss_len = p - tok;
 			}
-		} while (sc != 0);
+			n++;
+			tok = p + 1;
+		}
+	if (n < nspans) {
+		spans[n].ss_str = (const char *)tok;
+		spans[n].ss_len = end - tok;
 	}
-	/* NOTREACHED */
+	return (n + 1);
 }
@@ -7,33 +7,50 @@
  *
  * Written by Russ Allbery <rra@stanford.edu>
  * This work is hereby placed in the public domain by its author.
+ *
+ * The formatting is done by estream_vasprintf in a single pass; the
+ * result is collected in a stack buffer and only copied to the heap
+ * once its final size is known.  Formats it rejects, such as the wide
+ * character conversions, are handed to the system vsnprintf instead.
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "estream-printf.h"
 
-int
-vasprintf(char **strp, const char *fmt, va_list args)
+static int
+sys_vasprintf(char **strp, const char *fmt, va_list args)
 {
-    va_list args_copy;
-    int status, needed;
+    va_list ap;
+    int len;
 
-    va_copy(args_copy, args);
-    needed = vsnprintf(NULL, 0, fmt, args_copy);
-    va_end(args_copy);
-    if (needed < 0) {
-        *strp = NULL;
-        return needed;
-    }
-    *strp = malloc(needed + 1);
-    if (*strp == NULL)
+    *strp = NULL;
+    va_copy(ap, args);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return -1;
+    if ((*strp = malloc((size_t)len + 1)) == NULL)
         return -1;
-    status = vsnprintf(*strp, needed + 1, fmt, args);
-    if (status >= 0)
-        return status;
-    else {
+    if (vsnprintf(*strp, (size_t)len + 1, fmt, args) != len) {
         free(*strp);
         *strp = NULL;
-        return status;
+        return -1;
     }
+    return len;
+}
+
+int
+vasprintf(char **strp, const char *fmt, va_list args)
+{
+    va_list ap;
+    int status;
+
+    va_copy(ap, args);
+    status = estream_vasprintf(strp, fmt, ap);
+    va_end(ap);
+    if (status == -1 && errno == EINVAL && fmt != NULL)
+        status = sys_vasprintf(strp, fmt, args);
+    return status;
 }